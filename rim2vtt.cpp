@@ -1,14 +1,43 @@
-#include <tinyxml2.h>
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <charconv>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
 #include "el1/gen/dbg/amalgam/el1.hpp"
-#include "base64.h"
 #include "zlib.h"
+#include <xxhash.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
-using namespace tinyxml2;
 using namespace el1::error;
 
 namespace rim2vtt
@@ -31,12 +60,34 @@ namespace rim2vtt
 		return pos;
 	}
 
+	// the savegame text is not NUL terminated when parsed in-place => copy the (short) value first
+	static v2i_t V2iFromRimworldPos(const string_view str)
+	{
+		char buffer[64];
+		EL_ERROR(str.size() >= sizeof(buffer), TException, "position value too long");
+		memcpy(buffer, str.data(), str.size());
+		buffer[str.size()] = 0;
+		return V2iFromRimworldPos(buffer);
+	}
+
+	static s64_t ParseInteger(const string_view str)
+	{
+		char buffer[32];
+		EL_ERROR(str.size() >= sizeof(buffer), TException, "integer value too long");
+		memcpy(buffer, str.data(), str.size());
+		buffer[str.size()] = 0;
+		return strtoll(buffer, nullptr, 10);
+	}
+
 	struct light_source_t
 	{
 		v2i_t pos;
 		float range;
+		u32_t color;	// AARRGGBB, 0 = not set
 	};
 
+	static const light_source_t LIGHT_NONE = { v2i_t({0,0}), 0.0f, 0 };
+
 	enum class EObstacleType : u8_t
 	{
 		NONE,
@@ -51,268 +102,667 @@ namespace rim2vtt
 		EObstacleType type;
 	};
 
-	/****************************************************************************/
+	// Replaces the items of list with exactly n copies of value in a single allocation - the caller then fills them in
+	// by index. Lists whose final size is known up-front use this instead of growing one Append() at a time.
+	template<typename T>
+	static void SizeExactly(TList<T>& list, const usys_t n, const T& value)
+	{
+		list.Clear();
+		list.Inflate(n, value);
+	}
 
-	using tile_index_t = u16_t;	// change this if you need more
-	static const tile_index_t INDEX_NONE = (tile_index_t)-1;
+	static const obstacle_t OBSTACLE_NONE = { { v2f_t({0.0f,0.0f}), v2f_t({0.0f,0.0f}) }, EObstacleType::NONE };
 
-	class TObstacleMap;
-	class TObstacleNode;
+	/****************************************************************************/
 
-	class TObstacleNode
+	namespace direction
 	{
-		protected:
-			TObstacleMap* const map; // 8
-			const v2i_t pos; // 4
-			const EObstacleType type; // 1
-			u8_t mask_proccessed; // 1
-			u8_t mask_neighbor; // 1
-			u8_t n_all_neighbors : 4, // 1
-				 n_cross_neighbors : 3;
+		static const unsigned N = 8;
 
-			bool ComputeIsDoubleWall(const unsigned direction) const;
+		// do not change order!
+		static const v2i_t MAP[N] = {
+			{-1, 0}, // WEST
+			{-1,-1}, // NORTH WEST
+			{ 0,-1}, // NORTH
+			{ 1,-1}, // NORTH EAST
+			{ 1, 0}, // EAST
+			{ 1, 1}, // SOUTH EAST
+			{ 0, 1}, // SOUTH
+			{-1, 1}, // SOUTH WEST
+		};
 
-		public:
-			static const unsigned N_DIRECTIONS = 8;
-			static const v2i_t MAP_DIRECTIONS[N_DIRECTIONS];
-			static const v2f_t TILE_DIRECTIONS[N_DIRECTIONS];
-
-			static unsigned InvertDirection(const unsigned original_direction);
-			u8_t AllNeighborsCount() const { return this->n_all_neighbors; }
-			u8_t CrossNeighborsCount() const { return this->n_cross_neighbors; }
-			TObstacleMap* Map() { return this->map; }
-			v2i_t Position() const { return this->pos; }
-			EObstacleType Type() const { return this->type; }
-			bool HasUnprocessedDirections() const { return this->mask_proccessed != 255; }
-			TObstacleNode* Neighbor(const unsigned direction);
-			const TObstacleNode* Neighbor(const unsigned direction) const;
-			bool HasNeighbor(const unsigned direction) const;
-			bool WasDirectionProcessed(const unsigned direction) const;
-			void MarkDirectionProcessed(const unsigned direction, const bool mark = true);
-			void UpdateNeighbors();
-			TObstacleNode(TObstacleMap* const map, const v2i_t pos, const EObstacleType type) : map(map), pos(pos), type(type), mask_proccessed(0), mask_neighbor(0), n_all_neighbors(0), n_cross_neighbors(0) {}
-	};
+		// do not change order!
+		static const v2f_t TILE[N] = {
+			{ -0.5f,  0.0f }, // WEST
+			{ -0.5f, -0.5f }, // NORTH WEST
+			{  0.0f, -0.5f }, // NORTH
+			{  0.5f, -0.5f }, // NORTH EAST
+			{  0.5f,  0.0f }, // EAST
+			{  0.5f,  0.5f }, // SOUTH EAST
+			{  0.0f,  0.5f }, // SOUTH
+			{ -0.5f,  0.5f }, // SOUTH WEST
+		};
+
+		static unsigned Invert(const unsigned direction)
+		{
+			return (direction + N/2) % N;
+		}
+	}
 
+	// The obstacle map is a set of planes with one entry per tile (struct-of-arrays), a tile is identified by its
+	// index into the planes. The planes have a border of one empty tile around the map, so the neighbor in any
+	// direction is just a constant offset away and never needs a bounds check.
+	// An obstacle map covers a rectangle of the map (usually the image area, see TMap::CreateObstacleMap()), all
+	// positions are map coordinates nevertheless. Index() and Position() work on coordinates relative to origin.
 	class TObstacleMap
 	{
 		protected:
-			TList<TObstacleNode> nodes;
-			TList<tile_index_t> array;
-			TList<obstacle_t> graph;
+			const v2i_t origin;
 			const v2i_t size;
+			const usys_t stride;	// size[0] + 2
+			ssys_t offsets[direction::N];	// index delta to the neighbor in each direction
+			TList<EObstacleType> types;
+			TList<u8_t> masks_neighbor;
+			TList<u8_t> masks_processed;
+			TList<u8_t> n_cross_neighbors;
+			TList<obstacle_t> graph;
+
+			usys_t Index(const v2i_t pos) const { return (usys_t)((pos[1] + 1) * this->stride + pos[0] + 1); }
+			v2i_t Position(const usys_t index) const { return { (s16_t)(index % this->stride - 1), (s16_t)(index / this->stride - 1) }; }
+			v2f_t Center(const usys_t index) const { return (v2f_t)(this->Position(index) + this->origin); }	// in map coordinates
+			usys_t Neighbor(const usys_t index, const unsigned direction) const { return (usys_t)(index + this->offsets[direction]); }
+			bool HasNeighbor(const usys_t index, const unsigned direction) const { return ((this->masks_neighbor[index] >> direction) & 1) != 0; }
+			bool WasDirectionProcessed(const usys_t index, const unsigned direction) const { return ((this->masks_processed[index] >> direction) & 1) != 0; }
+			void MarkDirectionProcessed(const usys_t index, const unsigned direction) { this->masks_processed[index] |= (1 << direction); }
 
-			TObstacleNode* Walk(TObstacleNode& start_node, const unsigned direction, bool& terminated_by_transition_or_processed_direction);
+			bool ComputeIsDoubleWall(const usys_t index, const unsigned direction) const;
+			void UpdateNeighbors(const usys_t index);	// scalar reference for UpdateAllNeighbors()
+			void UpdateAllNeighbors(const usys_t n_threads);
+			usys_t Walk(const usys_t start, const unsigned direction, bool& terminated_by_transition_or_processed_direction);
+			// both write the segments into graph[idx_next...], TraceSegment() writes at most 3 of them
+			void TraceSegment(const usys_t start, const unsigned direction, usys_t& idx_next);
+			void TraceAxis(const usys_t start, const unsigned axis, usys_t& idx_next, const usys_t idx_end);	// axis: WEST (0) or NORTH (2)
+			unsigned CountTraces(const usys_t start, const unsigned axis) const;	// upper bound for the TraceSegment() calls of TraceAxis()
+			usys_t CountBands(const usys_t n_threads) const;
+			usys_t CornerTile(const usys_t corner, const unsigned direction, const bool right) const;
+			// writes run i from vertices[i] to vertices[i + 1] of type run_types[i] into graph[idx_next...], consecutive
+			// walls are simplified as one polyline unless idx_split (run_types.size() for none) starts a new one
+			// => never more segments than runs
+			void AppendRuns(const vector<v2f_t>& vertices, const vector<EObstacleType>& run_types, const usys_t idx_split, const float simplify_tolerance, usys_t& idx_next);
+			void AppendOutline(const vector<usys_t>& corners, const vector<u8_t>& directions, const v2f_t lo, const v2f_t hi, const float simplify_tolerance, usys_t& idx_next);
 
 		public:
-			v2i_t Size() const { return size; }
-			bool IsValidPosition(const v2i_t pos) const;
-			tile_index_t PlaceObstacleAt(const v2i_t pos, const EObstacleType type);
-			TObstacleNode* operator[](const v2i_t pos);
-			const TObstacleNode* operator[](const v2i_t pos) const;
-			void ComputeObstacleGraph();
+			v2i_t Size() const { return size; }	// of the covered rectangle
+			bool IsValidPosition(const v2i_t pos) const;	// true if pos is within the covered rectangle
+			void PlaceObstacleAt(const v2i_t pos, const EObstacleType type);
+			EObstacleType TypeAt(const v2i_t pos) const;	// NONE if there is no obstacle at pos (or pos is outside of the map)
+			// n_threads > 1 traces bands of large maps in parallel, the result does not depend on it
+			void ComputeObstacleGraph(const usys_t n_threads = 1);
+			// alternative to ComputeObstacleGraph(): only the outlines of the connected regions of obstacles
+			// simplify_tolerance > 0 simplifies the walls of the outlines (in tiles)
+			// The outlines are clipped to the rectangle [lo, hi] before they are simplified, so nothing outside of it
+			// (like the culled tiles, see TMap::CULL_MARGIN) changes the simplified walls within.
+			void ComputeContourGraph(const float simplify_tolerance, const v2f_t lo, const v2f_t hi);
 			const TList<const obstacle_t>& Graph() const { return this->graph; }
+			TList<obstacle_t>& RestoreGraph(const usys_t n_obstacles) { SizeExactly(this->graph, n_obstacles, OBSTACLE_NONE); return this->graph; }	// used by the cache: sizes the graph, the caller fills it in
+			void MergeCollinearSegments();	// see MergeCollinear()
+			void ClipSegments(const v2f_t lo, const v2f_t hi);	// see ClipToRectangle()
 
-			TObstacleMap(const v2i_t size);
+			// covers size tiles starting at origin
+			TObstacleMap(const v2i_t origin, const v2i_t size);
 	};
 
 	/****************************************************************************/
 
-	TObstacleNode* TObstacleNode::Neighbor(const unsigned direction)
+	static v2i_t RimworldRotationToVector(const int rot)
 	{
-		return (*this->map)[this->pos + MAP_DIRECTIONS[direction]];
+		switch(rot)
+		{
+			case 0: return direction::MAP[6];
+			case 1: return direction::MAP[4];
+			case 2: return direction::MAP[2];
+			case 3: return direction::MAP[0];
+			default: EL_THROW(TInvalidArgumentException, "rot");
+		}
 	}
 
-	const TObstacleNode* TObstacleNode::Neighbor(const unsigned direction) const
-	{
-		return (*this->map)[this->pos + MAP_DIRECTIONS[direction]];
-	}
+	/****************************************************************************/
 
-	bool TObstacleNode::HasNeighbor(const unsigned direction) const
+	bool TObstacleMap::ComputeIsDoubleWall(const usys_t index, const unsigned direction) const
 	{
-		return ((this->mask_neighbor >> direction) & 1) != 0;
+		// check half-circle around current position for obstacles of same type
+		for(signed i = -2; i <= 2; i++)
+		{
+			const unsigned check_direction = (direction + i + direction::N) % direction::N;
+			if(this->types[this->Neighbor(index, check_direction)] != this->types[index])
+				return false;
+		}
+
+		return true;
 	}
 
-	bool TObstacleNode::WasDirectionProcessed(const unsigned direction) const
+	void TObstacleMap::UpdateNeighbors(const usys_t index)
 	{
-		return ((this->mask_proccessed >> direction) & 1) != 0;
+		u8_t mask_neighbor = 0;
+		u8_t n_cross = 0;
+		for(unsigned i = 0; i < direction::N; i++)
+		{
+			const usys_t neighbor = this->Neighbor(index, i);
+			if(this->types[neighbor] != EObstacleType::NONE && !this->ComputeIsDoubleWall(index, i) && !this->ComputeIsDoubleWall(neighbor, direction::Invert(i)))
+			{
+				mask_neighbor |= (1 << i);
+				if((i % 2) == 0)
+					n_cross++;
+			}
+		}
+
+		this->masks_neighbor[index] = mask_neighbor;
+		this->masks_processed[index] = ~mask_neighbor;
+		this->n_cross_neighbors[index] = n_cross;
 	}
 
-	void TObstacleNode::MarkDirectionProcessed(const unsigned direction, const bool mark)
+	// Merges collinear walls which touch or overlap into a single wall and drops walls of zero length. Relies on the
+	// endpoints of axis-aligned segments being on the half-tile grid (which clipping at the image area keeps).
+	// Doors and windows are kept as they are - a row of merged doors would become a single door in the VTT. So are
+	// diagonal walls (from a simplified contour, see ComputeContourGraph()).
+	static void MergeCollinear(TList<obstacle_t>& graph)
 	{
-		if(mark)
-			this->mask_proccessed |= (1 << direction);
-		else
-			this->mask_proccessed &= ~(1 << direction);
+		struct span_t
+		{
+			EObstacleType type;
+			u8_t axis;	// 0 = horizontal, 1 = vertical
+			s32_t line;	// the constant coordinate, in half-tiles
+			s32_t from;
+			s32_t to;
+
+			bool operator<(const span_t& other) const
+			{
+				if(this->type != other.type) return this->type < other.type;
+				if(this->axis != other.axis) return this->axis < other.axis;
+				if(this->line != other.line) return this->line < other.line;
+				return this->from < other.from;
+			}
+		};
+
+		vector<span_t> spans;
+		vector<obstacle_t> unmerged;
+		spans.reserve(graph.Count());
+		for(usys_t i = 0; i < graph.Count(); i++)
+		{
+			const obstacle_t& obstacle = graph[i];
+			if(obstacle.type != EObstacleType::WALL || (obstacle.pos[0][0] != obstacle.pos[1][0] && obstacle.pos[0][1] != obstacle.pos[1][1]))
+			{
+				unmerged.push_back(obstacle);
+				continue;
+			}
+
+			const s32_t a[2] = { (s32_t)lroundf(obstacle.pos[0][0] * 2.0f), (s32_t)lroundf(obstacle.pos[0][1] * 2.0f) };
+			const s32_t b[2] = { (s32_t)lroundf(obstacle.pos[1][0] * 2.0f), (s32_t)lroundf(obstacle.pos[1][1] * 2.0f) };
+
+			if(a[0] == b[0] && a[1] == b[1])
+				continue;
+
+			const u8_t axis = a[1] == b[1] ? 0 : 1;
+			spans.push_back(span_t({ obstacle.type, axis, a[1 - axis], min(a[axis], b[axis]), max(a[axis], b[axis]) }));
+		}
+
+		sort(spans.begin(), spans.end());
+
+		// merges the spans in place, spans[0 .. n_merged) are the result
+		usys_t n_merged = 0;
+		for(usys_t i = 0; i < spans.size();)
+		{
+			span_t merged = spans[i++];
+			while(i < spans.size() && spans[i].type == merged.type && spans[i].axis == merged.axis && spans[i].line == merged.line && spans[i].from <= merged.to)
+				merged.to = max(merged.to, spans[i++].to);
+			spans[n_merged++] = merged;
+		}
+
+		// everything of the old graph is in spans and unmerged now => it is rebuilt in place at its final size
+		SizeExactly(graph, n_merged + unmerged.size(), OBSTACLE_NONE);
+		for(usys_t i = 0; i < n_merged; i++)
+		{
+			const float line = spans[i].line / 2.0f;
+			const float from = spans[i].from / 2.0f;
+			const float to = spans[i].to / 2.0f;
+			if(spans[i].axis == 0)
+				graph[i] = obstacle_t({ { v2f_t({ from, line }), v2f_t({ to, line }) }, spans[i].type });
+			else
+				graph[i] = obstacle_t({ { v2f_t({ line, from }), v2f_t({ line, to }) }, spans[i].type });
+		}
+		for(usys_t i = 0; i < unmerged.size(); i++)
+			graph[n_merged + i] = unmerged[i];
 	}
 
-	bool TObstacleNode::ComputeIsDoubleWall(const unsigned direction) const
+	// Douglas-Peucker: keeps the first and the last point and as few of the others as possible such that no point
+	// is further than tolerance away from the simplified polyline. Appends the kept points to out.
+	static void SimplifyPolyline(const v2f_t* const points, const usys_t n_points, const float tolerance, vector<v2f_t>& out)
 	{
-		// check half-circle around current position for obstacles of same typelib
+		vector<bool> keep(n_points, false);
+		keep[0] = keep[n_points - 1] = true;
 
-		for(signed i = -2; i <= 2; i++)
+		// explicit stack - outlines of large rock masses have many thousand points
+		vector<pair<usys_t, usys_t>> stack = { { 0, n_points - 1 } };
+		while(!stack.empty())
 		{
-			signed check_direction = direction + i;
-			if(check_direction < 0)
-				check_direction += 8;
-			else if(check_direction >= 8)
-				check_direction -= 8;
+			const usys_t first = stack.back().first;
+			const usys_t last = stack.back().second;
+			stack.pop_back();
 
-			const TObstacleNode* const neighbor = this->Neighbor(check_direction);
-			if(neighbor == nullptr || neighbor->Type() != this->Type())
-				return false;
+			const float dx = points[last][0] - points[first][0];
+			const float dy = points[last][1] - points[first][1];
+			const float length = sqrtf(dx * dx + dy * dy);
+
+			float max_distance = 0.0f;
+			usys_t idx_max = first;
+			for(usys_t i = first + 1; i < last; i++)
+			{
+				const float px = points[i][0] - points[first][0];
+				const float py = points[i][1] - points[first][1];
+				const float distance = length > 0.0f ? fabsf(px * dy - py * dx) / length : sqrtf(px * px + py * py);
+				if(distance > max_distance)
+				{
+					max_distance = distance;
+					idx_max = i;
+				}
+			}
+
+			if(max_distance > tolerance)
+			{
+				keep[idx_max] = true;
+				stack.push_back({ first, idx_max });
+				stack.push_back({ idx_max, last });
+			}
 		}
 
-		return true;
+		for(usys_t i = 0; i < n_points; i++)
+			if(keep[i])
+				out.push_back(points[i]);
+	}
+
+	void TObstacleMap::MergeCollinearSegments()
+	{
+		MergeCollinear(this->graph);
 	}
 
-	void TObstacleNode::UpdateNeighbors()
+	// Clips the segment exactly to the rectangle [lo, hi] (Liang-Barsky), returns false if nothing of it is left.
+	// Segments on the border of the rectangle are kept, segments which only touch it in a single point are not.
+	static bool ClipSegment(const obstacle_t& obstacle, const v2f_t lo, const v2f_t hi, obstacle_t& clipped)
 	{
-		this->mask_proccessed = 0;
-		this->mask_neighbor = 0;
-		this->n_all_neighbors = 0;
-		this->n_cross_neighbors = 0;
-		for(unsigned i = 0; i < N_DIRECTIONS; i++)
+		const v2f_t from = obstacle.pos[0];
+		const v2f_t delta = obstacle.pos[1] - obstacle.pos[0];
+		float t_enter = 0.0f;
+		float t_leave = 1.0f;
+
+		for(unsigned axis = 0; axis < 2; axis++)
 		{
-			const TObstacleNode* const neighbor = this->Neighbor(i);
-			if(neighbor != nullptr && !this->ComputeIsDoubleWall(i) && !neighbor->ComputeIsDoubleWall(InvertDirection(i)))
+			if(delta[axis] == 0.0f)
 			{
-				this->n_all_neighbors++;
-				this->mask_neighbor |= (1 << i);
+				if(from[axis] < lo[axis] || from[axis] > hi[axis])
+					return false;
+				continue;
 			}
-			else
-				this->MarkDirectionProcessed(i);
 
-			if((i % 2) == 0 && this->HasNeighbor(i))
-				n_cross_neighbors++;
+			float t_lo = (lo[axis] - from[axis]) / delta[axis];
+			float t_hi = (hi[axis] - from[axis]) / delta[axis];
+			if(t_lo > t_hi)
+				swap(t_lo, t_hi);
+			t_enter = max(t_enter, t_lo);
+			t_leave = min(t_leave, t_hi);
+			if(t_enter >= t_leave)
+				return false;
+		}
+
+		// keep the original endpoints where they are inside, so the axis-aligned segments stay on the half-tile grid
+		clipped = obstacle;
+		for(unsigned axis = 0; axis < 2; axis++)
+		{
+			if(t_enter > 0.0f)
+				clipped.pos[0][axis] = delta[axis] == 0.0f ? from[axis] : min(max(from[axis] + t_enter * delta[axis], lo[axis]), hi[axis]);
+			if(t_leave < 1.0f)
+				clipped.pos[1][axis] = delta[axis] == 0.0f ? from[axis] : min(max(from[axis] + t_leave * delta[axis], lo[axis]), hi[axis]);
 		}
+		return true;
 	}
 
-	// do not change order!
-	const v2i_t TObstacleNode::MAP_DIRECTIONS[TObstacleNode::N_DIRECTIONS] = {
-		{-1, 0}, // WEST
-		{-1,-1}, // NORTH WEST
-		{ 0,-1}, // NORTH
-		{ 1,-1}, // NORTH EAST
-		{ 1, 0}, // EAST
-		{ 1, 1}, // SOUTH EAST
-		{ 0, 1}, // SOUTH
-		{-1, 1}, // SOUTH WEST
-	};
+	// Clips every segment of the graph with ClipSegment() and drops the ones outside of the rectangle. The kept
+	// segments are moved to the front of the graph in place and the rest is cut off, nothing is allocated.
+	static void ClipToRectangle(TList<obstacle_t>& graph, const v2f_t lo, const v2f_t hi)
+	{
+		obstacle_t clipped = OBSTACLE_NONE;
+		usys_t n_kept = 0;
+		for(usys_t i = 0; i < graph.Count(); i++)
+			if(ClipSegment(graph[i], lo, hi, clipped))
+				graph[n_kept++] = clipped;
 
-	// do not change order!
-	const v2f_t TObstacleNode::TILE_DIRECTIONS[TObstacleNode::N_DIRECTIONS] = {
-		{ -0.5f,  0.0f }, // WEST
-		{ -0.5f, -0.5f }, // NORTH WEST
-		{  0.0f, -0.5f }, // NORTH
-		{  0.5f, -0.5f }, // NORTH EAST
-		{  0.5f,  0.0f }, // EAST
-		{  0.5f,  0.5f }, // SOUTH EAST
-		{  0.0f,  0.5f }, // SOUTH
-		{ -0.5f,  0.5f }, // SOUTH WEST
-	};
+		graph.Cut(0, graph.Count() - n_kept);
+	}
 
-	static v2i_t RimworldRotationToVector(const int rot)
+	// like above, but the clipped segments go into kept - which is sized for the worst case (every segment is kept)
+	// and then cut to the ones actually kept, so it is allocated exactly once
+	static void ClipToRectangle(const TList<const obstacle_t>& graph, const v2f_t lo, const v2f_t hi, TList<obstacle_t>& kept)
 	{
-		switch(rot)
+		SizeExactly(kept, graph.Count(), OBSTACLE_NONE);
+		usys_t n_kept = 0;
+		for(usys_t i = 0; i < graph.Count(); i++)
+			if(ClipSegment(graph[i], lo, hi, kept[n_kept]))
+				n_kept++;
+
+		kept.Cut(0, kept.Count() - n_kept);
+	}
+
+	// Clips a polyline to the rectangle [lo, hi] like ClipToRectangle() clips segments. Edges which are still connected
+	// after clipping stay one polyline, a polyline which leaves the rectangle and comes back is split up.
+	static void ClipPolyline(const vector<v2f_t>& polyline, const v2f_t lo, const v2f_t hi, vector<vector<v2f_t>>& out)
+	{
+		if(polyline.size() < 2)
+			return;
+
+		TList<obstacle_t> edges;
+		SizeExactly(edges, polyline.size() - 1, OBSTACLE_NONE);
+		for(usys_t i = 0; i + 1 < polyline.size(); i++)
 		{
-			case 0: return TObstacleNode::MAP_DIRECTIONS[6];
-			case 1: return TObstacleNode::MAP_DIRECTIONS[4];
-			case 2: return TObstacleNode::MAP_DIRECTIONS[2];
-			case 3: return TObstacleNode::MAP_DIRECTIONS[0];
-			default: EL_THROW(TInvalidArgumentException, "rot");
+			edges[i].pos[0] = polyline[i];
+			edges[i].pos[1] = polyline[i + 1];
+			edges[i].type = EObstacleType::WALL;
+		}
+		ClipToRectangle(edges, lo, hi);
+
+		// endpoints inside the rectangle keep their exact value, so consecutive edges which still meet share the same point
+		for(usys_t i = 0; i < edges.Count(); i++)
+		{
+			const bool connected = i > 0 && edges[i - 1].pos[1][0] == edges[i].pos[0][0] && edges[i - 1].pos[1][1] == edges[i].pos[0][1];
+			if(!connected)
+				out.push_back(vector<v2f_t>(1, edges[i].pos[0]));
+			out.back().push_back(edges[i].pos[1]);
 		}
 	}
 
-	unsigned TObstacleNode::InvertDirection(const unsigned direction)
+	void TObstacleMap::ClipSegments(const v2f_t lo, const v2f_t hi)
 	{
-		return (direction + N_DIRECTIONS/2) % N_DIRECTIONS;
+		ClipToRectangle(this->graph, lo, hi);
 	}
 
-	/****************************************************************************/
-
-	bool TObstacleMap::IsValidPosition(const v2i_t pos) const
+	// runs fn(idx_band) for every band on its own thread (band 0 runs on the calling thread) and waits for all of them
+	static void RunBands(const usys_t n_bands, const function<void(const usys_t idx_band)>& fn)
 	{
-		return pos[0] >= 0 && pos[1] >= 0 && pos[0] < size[0] && pos[1] < size[1];
+		vector<thread> threads;
+		for(usys_t idx_band = 1; idx_band < n_bands; idx_band++)
+			threads.emplace_back(fn, idx_band);
+		fn(0);
+		for(auto& t : threads)
+			t.join();
 	}
 
-	tile_index_t TObstacleMap::PlaceObstacleAt(const v2i_t pos, const EObstacleType type)
+	// first item of band idx_band when n_items are split into n_bands
+	static usys_t BandBegin(const usys_t n_items, const usys_t n_bands, const usys_t idx_band)
 	{
-		tile_index_t& index = this->array[pos[1] * this->size[0] + pos[0]];
-		EL_ERROR(index != INDEX_NONE, TException, TString::Format("cannot place obstacle at {%d; %d}: there is already an obstacle here (current-type: %d, wanted-type: %d)", pos[0], pos[1], (u8_t)this->nodes[index].Type(), (u8_t)type));
-		EL_ERROR(this->nodes.Count() >= (usys_t)((tile_index_t)-2), TException, TString::Format("too many obstacles on map (current: %d, limit: %d)", this->nodes.Count(), (tile_index_t)-2));
+		return n_items * idx_band / n_bands;
+	}
 
-		this->nodes.Append(TObstacleNode(this, pos, type));
-		index = this->nodes.Count() - 1;
-		return index;
+	// returns the 64 bits of a bit plane starting at bit (which may be negative or point past the end, as long as
+	// the plane has guard words there)
+	static inline u64_t ExtractBits(const u64_t* const plane, const ssys_t bit)
+	{
+		const ssys_t idx_word = bit >> 6;
+		const unsigned shift = bit & 63;
+		if(shift == 0)
+			return plane[idx_word];
+		return (plane[idx_word] >> shift) | (plane[idx_word + 1] << (64 - shift));
 	}
 
-	TObstacleNode* TObstacleMap::operator[](const v2i_t pos)
+	// Same result as calling UpdateNeighbors() on every obstacle, but 64 tiles at a time: each obstacle type becomes a bit
+	// plane over the padded grid, so the neighbor in a direction is the plane shifted by the neighbor offset. The double
+	// wall test of a whole word is then five ANDs per direction instead of five lookups per tile and direction.
+	// Define RIM2VTT_CHECK_NEIGHBORS to compare the result against the scalar path.
+	void TObstacleMap::UpdateAllNeighbors(const usys_t n_threads)
 	{
-		if(this->IsValidPosition(pos))
+		static const unsigned N_TYPES = 4;	// plane 0 holds all obstacles, the others one EObstacleType each
+
+		const usys_t n_words = (this->types.Count() + 63) / 64;
+		const usys_t n_guard = (this->stride + 1) / 64 + 2;
+		const usys_t sz_plane = n_words + 2 * n_guard;
+		vector<u64_t> storage((N_TYPES + direction::N) * sz_plane, 0);
+
+		u64_t* planes[N_TYPES];
+		u64_t* double_walls[direction::N];
+		for(unsigned i = 0; i < N_TYPES; i++)
+			planes[i] = &storage[i * sz_plane + n_guard];
+		for(unsigned i = 0; i < direction::N; i++)
+			double_walls[i] = &storage[(N_TYPES + i) * sz_plane + n_guard];
+
+		// the bands split the planes at word boundaries => every band only writes to its own words and tiles,
+		// but reads the words of its neighbors => each step must be complete before the next one starts
+		const usys_t n_bands = this->CountBands(n_threads);
+
+		RunBands(n_bands, [&](const usys_t idx_band) {
+			const usys_t idx_end = min(BandBegin(n_words, n_bands, idx_band + 1) * 64, this->types.Count());
+			for(usys_t index = BandBegin(n_words, n_bands, idx_band) * 64; index < idx_end; index++)
+			{
+				const EObstacleType type = this->types[index];
+				if(type != EObstacleType::NONE)
+				{
+					planes[0][index / 64] |= (u64_t)1 << (index % 64);
+					planes[(u8_t)type][index / 64] |= (u64_t)1 << (index % 64);
+				}
+			}
+		});
+
+		// a tile is a double wall in a direction if the half-circle of five neighbors around it has its own type
+		RunBands(n_bands, [&](const usys_t idx_band) {
+			for(usys_t idx_word = BandBegin(n_words, n_bands, idx_band); idx_word < BandBegin(n_words, n_bands, idx_band + 1); idx_word++)
+			{
+				u64_t double_wall[direction::N] = {};
+				for(unsigned type = 1; type < N_TYPES; type++)
+				{
+					const u64_t own = planes[type][idx_word];
+					if(own == 0)
+						continue;
+
+					u64_t same[direction::N];
+					for(unsigned d = 0; d < direction::N; d++)
+						same[d] = ExtractBits(planes[type], idx_word * 64 + this->offsets[d]);
+
+					for(unsigned d = 0; d < direction::N; d++)
+						double_wall[d] |= own & same[(d + 6) % 8] & same[(d + 7) % 8] & same[d] & same[(d + 1) % 8] & same[(d + 2) % 8];
+				}
+
+				for(unsigned d = 0; d < direction::N; d++)
+					double_walls[d][idx_word] = double_wall[d];
+			}
+		});
+
+		// a neighbor counts unless either side of the connection is a double wall towards the other
+		RunBands(n_bands, [&](const usys_t idx_band) {
+			for(usys_t idx_word = BandBegin(n_words, n_bands, idx_band); idx_word < BandBegin(n_words, n_bands, idx_band + 1); idx_word++)
+			{
+				const u64_t own = planes[0][idx_word];
+				if(own == 0)
+					continue;
+
+				u64_t neighbor[direction::N];
+				for(unsigned d = 0; d < direction::N; d++)
+				{
+					const ssys_t bit = idx_word * 64 + this->offsets[d];
+					neighbor[d] = own & ExtractBits(planes[0], bit) & ~double_walls[d][idx_word] & ~ExtractBits(double_walls[direction::Invert(d)], bit);
+				}
+
+				for(u64_t remaining = own; remaining != 0; remaining &= remaining - 1)
+				{
+					const unsigned idx_bit = __builtin_ctzll(remaining);
+					u8_t mask_neighbor = 0;
+					for(unsigned d = 0; d < direction::N; d++)
+						mask_neighbor |= ((neighbor[d] >> idx_bit) & 1) << d;
+
+					const usys_t index = idx_word * 64 + idx_bit;
+					this->masks_neighbor[index] = mask_neighbor;
+					this->masks_processed[index] = ~mask_neighbor;
+					this->n_cross_neighbors[index] = __builtin_popcount(mask_neighbor & 0x55);	// WEST, NORTH, EAST, SOUTH
+				}
+			}
+		});
+
+#ifdef RIM2VTT_CHECK_NEIGHBORS
+		for(usys_t index = 0; index < this->types.Count(); index++)
 		{
-			const tile_index_t index = this->array[pos[1] * this->size[0] + pos[0]];
-			if(index != INDEX_NONE)
-				return &this->nodes[index];
-			else
-				return nullptr;
+			if(this->types[index] == EObstacleType::NONE)
+				continue;
+
+			const u8_t mask_neighbor = this->masks_neighbor[index];
+			const u8_t n_cross = this->n_cross_neighbors[index];
+			this->UpdateNeighbors(index);
+			EL_ERROR(this->masks_neighbor[index] != mask_neighbor || this->n_cross_neighbors[index] != n_cross, TLogicException);
 		}
-		else
-			return nullptr;
+#endif
 	}
 
-	const TObstacleNode* TObstacleMap::operator[](const v2i_t pos) const
+	bool TObstacleMap::IsValidPosition(const v2i_t pos) const
 	{
-		if(this->IsValidPosition(pos))
-		{
-			const tile_index_t index = this->array[pos[1] * this->size[0] + pos[0]];
-			if(index != INDEX_NONE)
-				return &this->nodes[index];
-			else
-				return nullptr;
-		}
-		else
-			return nullptr;
+		const v2i_t local = pos - this->origin;
+		return local[0] >= 0 && local[1] >= 0 && local[0] < size[0] && local[1] < size[1];
+	}
+
+	void TObstacleMap::PlaceObstacleAt(const v2i_t pos, const EObstacleType type)
+	{
+		EL_ERROR(!this->IsValidPosition(pos), TLogicException);
+		EObstacleType& current = this->types[this->Index(pos - this->origin)];
+		EL_ERROR(current != EObstacleType::NONE, TException, TString::Format("cannot place obstacle at {%d; %d}: there is already an obstacle here (current-type: %d, wanted-type: %d)", pos[0], pos[1], (u8_t)current, (u8_t)type));
+		current = type;
+	}
+
+	EObstacleType TObstacleMap::TypeAt(const v2i_t pos) const
+	{
+		return this->IsValidPosition(pos) ? this->types[this->Index(pos - this->origin)] : EObstacleType::NONE;
 	}
 
-	TObstacleNode* TObstacleMap::Walk(TObstacleNode& start_node, const unsigned direction, bool& terminated_by_transition_or_processed_direction)
+	usys_t TObstacleMap::Walk(const usys_t start, const unsigned direction, bool& terminated_by_transition_or_processed_direction)
 	{
-		unsigned n_walk_distance = 0;
+		const unsigned inverted_direction = direction::Invert(direction);
 
-		TObstacleNode* current_node = &start_node;
-		while(current_node->HasNeighbor(direction))
+		usys_t current = start;
+		while(this->HasNeighbor(current, direction))
 		{
-			current_node->MarkDirectionProcessed(direction);
-			TObstacleNode* const neighbor = current_node->Neighbor(direction);
+			this->MarkDirectionProcessed(current, direction);
+			const usys_t neighbor = this->Neighbor(current, direction);
 
-			if(neighbor->Type() != start_node.Type() || neighbor->WasDirectionProcessed(TObstacleNode::InvertDirection(direction)))
+			if(this->types[neighbor] != this->types[start] || this->WasDirectionProcessed(neighbor, inverted_direction))
 			{
 				terminated_by_transition_or_processed_direction = true;
-				return current_node;
+				return current;
 			}
 
-			if(neighbor->CrossNeighborsCount() > 2)
+			if(this->n_cross_neighbors[neighbor] > 2)
 			{
 				terminated_by_transition_or_processed_direction = false;
-				neighbor->MarkDirectionProcessed(TObstacleNode::InvertDirection(direction));
+				this->MarkDirectionProcessed(neighbor, inverted_direction);
 				return neighbor;
 			}
 
-			current_node = neighbor;
-			current_node->MarkDirectionProcessed(TObstacleNode::InvertDirection(direction));
-			n_walk_distance++;
+			current = neighbor;
+			this->MarkDirectionProcessed(current, inverted_direction);
 		}
 
 		terminated_by_transition_or_processed_direction = false;
-		current_node->MarkDirectionProcessed(direction);
-		return current_node;
+		this->MarkDirectionProcessed(current, direction);
+		return current;
 	}
 
-	void TObstacleMap::ComputeObstacleGraph()
+	void TObstacleMap::TraceSegment(const usys_t start, const unsigned direction, usys_t& idx_next)
 	{
-		this->graph.Clear();
+		const EObstacleType type = this->types[start];
+		usys_t endpoints[2] = {};
+		bool terminated_by_transition_or_processed_direction[2] = {};
+		v2f_t endpoint_positions[2];
+		unsigned endpoint_directions[2] = { direction, direction::Invert(direction) };
+
+		endpoints[0] = this->Walk(start, endpoint_directions[0], terminated_by_transition_or_processed_direction[0]);
+		endpoints[1] = this->n_cross_neighbors[start] > 2 ? start : this->Walk(start, endpoint_directions[1], terminated_by_transition_or_processed_direction[1]);
+
+		for(unsigned idx_endpoint = 0; idx_endpoint < 2; idx_endpoint++)
+		{
+			const usys_t endpoint = endpoints[idx_endpoint];
+			const v2f_t endpoint_center = this->Center(endpoint);
+			v2f_t& position = endpoint_positions[idx_endpoint];
+			const unsigned endpoint_direction = endpoint_directions[idx_endpoint];
+
+			if(terminated_by_transition_or_processed_direction[idx_endpoint])
+			{
+				if(this->n_cross_neighbors[endpoint] > 2)
+				{
+					// place obstacle at center
+					position = endpoint_center;
+
+					// create second obstacle from center towards edge
+					if(endpoints[0] != endpoints[1] || idx_endpoint == 0)
+					{
+						this->graph[idx_next++] = obstacle_t({
+							{
+								endpoint_center,
+								endpoint_center + direction::TILE[endpoint_direction]
+							},
+							type
+						});
+					}
+				}
+				else
+				{
+					// place obstacle at edge
+					position = endpoint_center + direction::TILE[endpoint_direction];
+				}
+			}
+			else
+			{
+				// place at center
+				position = endpoint_center;
+			}
+		}
+
+		this->graph[idx_next++] = obstacle_t({ { endpoint_positions[0], endpoint_positions[1] }, type });
+	}
+
+	void TObstacleMap::TraceAxis(const usys_t start, const unsigned axis, usys_t& idx_next, const usys_t idx_end)
+	{
+		if(this->types[start] == EObstacleType::NONE)
+			return;
+
+		// the second direction is only left unprocessed if start is a junction
+		for(unsigned direction = axis; direction < direction::N; direction += direction::N / 2)
+			if(!this->WasDirectionProcessed(start, direction))
+			{
+				EL_ERROR(idx_next + 3 > idx_end, TLogicException);	// CountTraces() was wrong
+				this->TraceSegment(start, direction, idx_next);
+			}
+	}
+
+	unsigned TObstacleMap::CountTraces(const usys_t start, const unsigned axis) const
+	{
+		// the walks only run along the links between neighbors (every other direction starts out processed)
+		const unsigned forward = direction::Invert(axis);
+		if(this->types[start] == EObstacleType::NONE || (!this->HasNeighbor(start, axis) && !this->HasNeighbor(start, forward)))
+			return 0;
 
-		for(usys_t i = 0; i < this->nodes.Count(); i++)
-			this->nodes[i].UpdateNeighbors();
+		// a junction stops the walks into it, so both of its directions may still be left
+		if(this->n_cross_neighbors[start] > 2)
+			return 2;
+
+		// the tile before start on the axis was visited first: if a walk could continue from it into start, it did
+		// and took both directions of start along
+		const usys_t previous = this->Neighbor(start, axis);
+		const bool continued = this->HasNeighbor(start, axis) && this->HasNeighbor(previous, forward) && this->types[previous] == this->types[start];
+		return continued ? 0 : 1;
+	}
+
+	usys_t TObstacleMap::CountBands(const usys_t n_threads) const
+	{
+		// threads only pay off if each of them gets a reasonable amount of tiles
+		static const usys_t MIN_TILES_PER_BAND = 64 * 1024;
+		return max((usys_t)1, min(n_threads, this->types.Count() / MIN_TILES_PER_BAND));
+	}
+
+	void TObstacleMap::ComputeObstacleGraph(const usys_t n_threads)
+	{
+		this->graph.Clear();
+		this->UpdateAllNeighbors(n_threads);
 
 		// start at an obstructed tile with unprocessed directions
 		// pick a unprocessed direction
@@ -330,378 +780,4543 @@ namespace rim2vtt
 		// check if the current tile has more unprocessed directions
 		// else find the next tile with unprocessed directions
 		// NOTE: freestanding obstructed tiles ("columns" / "pillars") will not spawn any obstacle_t's
+		// NOTE: start tiles are picked in grid order, so the graph does not depend on the order in which the obstacles were placed
+		// NOTE: walks never change direction and only touch the processed bits of their own axis => horizontal and vertical
+		//   segments can be traced independently, row by row and column by column, which yields exactly the segments of a
+		//   single row-major pass over both axes. Rows (and columns) do not interact, so bands of them run in parallel.
+		// NOTE: every band writes into its own slice of the graph, which is sized once for all of them from
+		//   CountTraces() and compacted afterwards.
 
-		for(usys_t idx_start_node = 0; idx_start_node < this->nodes.Count(); idx_start_node++)
-		{
-			TObstacleNode& start_node = this->nodes[idx_start_node];
-			if(start_node.HasUnprocessedDirections())
-			{
-				for(unsigned direction = 0; direction < TObstacleNode::N_DIRECTIONS; direction += 2)
-				{
-					if(!start_node.WasDirectionProcessed(direction))
-					{
-						TObstacleNode* endpoints[2] = {};
-						bool terminated_by_transition_or_processed_direction[2] = {};
-						v2f_t endpoint_positions[2];
-						unsigned endpoint_directions[2] = { direction, TObstacleNode::InvertDirection(direction) };
+		const usys_t n_bands = this->CountBands(n_threads);
 
-						endpoints[0] = Walk(start_node, endpoint_directions[0], terminated_by_transition_or_processed_direction[0]);
-						endpoints[1] = start_node.CrossNeighborsCount() > 2 ? &start_node : Walk(start_node, endpoint_directions[1], terminated_by_transition_or_processed_direction[1]);
-
-						for(unsigned idx_endpoint = 0; idx_endpoint < 2; idx_endpoint++)
-						{
-							TObstacleNode& endpoint = *endpoints[idx_endpoint];
-							v2f_t& position = endpoint_positions[idx_endpoint];
-							const unsigned endpoint_direction = endpoint_directions[idx_endpoint];
-
-							if(terminated_by_transition_or_processed_direction[idx_endpoint])
-							{
-								if(endpoint.CrossNeighborsCount() > 2)
-								{
-									// place obstacle at center
-									position = (v2f_t)endpoint.Position();
-
-									// create second obstacle from center towards edge
-									if(endpoints[0] != endpoints[1] || idx_endpoint == 0)
-									{
-										this->graph.Append(obstacle_t({
-											{
-												(v2f_t)endpoint.Position(),
-												(v2f_t)endpoint.Position() + TObstacleNode::TILE_DIRECTIONS[endpoint_direction]
-											},
-											start_node.Type()
-										}));
-									}
-								}
-								else //if(endpoint.NeighborsCount() <= 2)
-								{
-									// place obstacle at edge
-									position = (v2f_t)endpoint.Position() + TObstacleNode::TILE_DIRECTIONS[endpoint_direction];
-								}
-							}
-							else
-							{
-								// place at center
-								position = (v2f_t)endpoint.Position();
-							}
-						}
+		// slice i is [idx_begin[i], idx_begin[i + 1]), the horizontal bands come first, then the vertical ones
+		// idx_next[i] is where band i writes its next segment
+		vector<usys_t> idx_begin(2 * n_bands + 1, 0);
+		vector<usys_t> idx_next(2 * n_bands, 0);
 
-						this->graph.Append(obstacle_t({ { endpoint_positions[0], endpoint_positions[1] }, start_node.Type() }));
-					}
+		// calls fn(start, axis) for every tile of slice idx_slice: horizontal bands run row by row, vertical ones column by column
+		auto for_slice = [&](const usys_t idx_slice, const auto& fn) {
+			const usys_t idx_band = idx_slice % n_bands;
+			if(idx_slice < n_bands)
+			{
+				for(s16_t y = BandBegin(this->size[1], n_bands, idx_band); y < (s16_t)BandBegin(this->size[1], n_bands, idx_band + 1); y++)
+				{
+					const usys_t row = this->Index({0,y});
+					for(usys_t start = row; start < row + this->size[0]; start++)
+						fn(start, 0);
 				}
 			}
-		}
-	}
-
-	TObstacleMap::TObstacleMap(const v2i_t size) : size(size)
-	{
-		array.Inflate(size[0] * size[1], INDEX_NONE);
-	}
-
-	/****************************************************************************/
+			else
+			{
+				for(s16_t x = BandBegin(this->size[0], n_bands, idx_band); x < (s16_t)BandBegin(this->size[0], n_bands, idx_band + 1); x++)
+				{
+					for(usys_t start = this->Index({x,0}); start < this->Index({x,this->size[1]}); start += this->stride)
+						fn(start, 2);
+				}
+			}
+		};
 
-	struct TMap
-	{
-		TObstacleMap obstacle_map;
-		TList<light_source_t> lights;
-		const v2i_t size;
-		v2i_t image_pos;
-		v2i_t image_size;
+		// TraceSegment() writes at most 3 segments per call
+		RunBands(n_bands, [&](const usys_t idx_band) {
+			for(usys_t idx_slice = idx_band; idx_slice < 2 * n_bands; idx_slice += n_bands)
+				for_slice(idx_slice, [&](const usys_t start, const unsigned axis) {
+					idx_begin[idx_slice + 1] += 3 * this->CountTraces(start, axis);
+				});
+		});
 
-		bool IsWithinImageArea(const v2i_t pos) const
+		for(usys_t i = 0; i < 2 * n_bands; i++)
 		{
-			return pos.AllBiggerEqual(image_pos) && pos.AllLess(image_pos + image_size);
+			idx_begin[i + 1] += idx_begin[i];
+			idx_next[i] = idx_begin[i];
 		}
+		SizeExactly(this->graph, idx_begin[2 * n_bands], OBSTACLE_NONE);
 
-		bool IsWithinImageArea(const v2f_t pos) const
-		{
-			return pos.AllBiggerEqual((v2f_t)image_pos - v2f_t({1.0f,1.0f})) && pos.AllLess((v2f_t)image_pos + (v2f_t)image_size + v2f_t({1.0f,1.0f}));
-		}
+		// horizontal segments (WEST/EAST), then vertical segments (NORTH/SOUTH) - the walks of both axes update the
+		// same bytes of masks_processed, so the axes must not run at the same time
+		for(usys_t idx_first_slice = 0; idx_first_slice < 2 * n_bands; idx_first_slice += n_bands)
+			RunBands(n_bands, [&](const usys_t idx_band) {
+				const usys_t idx_slice = idx_first_slice + idx_band;
+				for_slice(idx_slice, [&](const usys_t start, const unsigned axis) {
+					this->TraceAxis(start, axis, idx_next[idx_slice], idx_begin[idx_slice + 1]);
+				});
+			});
 
-		void ExportVTT(ostream& os, TFile* const image);
-		TMap(XMLElement* map_node);
-	};
+		// the slices are concatenated in band order => the order of the segments does not depend on the number of threads either
+		usys_t n_segments = 0;
+		for(usys_t i = 0; i < 2 * n_bands; i++)
+			for(usys_t idx_segment = idx_begin[i]; idx_segment < idx_next[i]; idx_segment++)
+				this->graph[n_segments++] = this->graph[idx_segment];
+		this->graph.Cut(0, this->graph.Count() - n_segments);
+	}
 
-	static bool IsBase64Char(const char chr)
+	// corner c is the top left corner of tile c => the tiles around it are c (SE), c - 1 (SW), c - stride (NE) and
+	// c - stride - 1 (NW). Returns the tile to the right (or left) of the edge leaving the corner in direction.
+	usys_t TObstacleMap::CornerTile(const usys_t corner, const unsigned direction, const bool right) const
 	{
-		return (chr >= 'A' && chr <= 'Z') || (chr >= 'a' && chr <= 'z') || (chr >= '0' && chr <= '9') || chr == '+' || chr == '/' || chr == '=';
+		// clockwise, starting with the tile right of WEST: NW, NE, SE, SW
+		const ssys_t around[4] = { this->offsets[1], this->offsets[2], 0, this->offsets[0] };
+		return (usys_t)(corner + around[(direction / 2 + (right ? 0 : 3)) % 4]);
 	}
 
-	TMap::TMap(XMLElement* map_node) : obstacle_map(V2iFromRimworldPos(map_node->FirstChildElement("mapInfo")->FirstChildElement("size")->GetText())), size(obstacle_map.Size())
+	void TObstacleMap::AppendRuns(const vector<v2f_t>& vertices, const vector<EObstacleType>& run_types, const usys_t idx_split, const float simplify_tolerance, usys_t& idx_next)
 	{
-		cerr<<endl<<"map ID: "<<map_node->FirstChildElement("uniqueID")->UnsignedText()<<endl;
-		cerr<<"size: ["<<this->size[0]<<"; "<<this->size[1]<<"]"<<endl;
-
-		this->image_pos = {0,0};
-		this->image_size = this->size;
-
-		for(auto list_node = map_node->FirstChildElement("components")->FirstChildElement("li"); list_node != nullptr; list_node = list_node->	NextSiblingElement())
+		// only walls are simplified, doors and windows stay exactly where they are
+		const usys_t n_runs = run_types.size();
+		vector<v2f_t> simplified;
+		for(usys_t i = 0; i < n_runs;)
 		{
-			if(list_node->Attribute("Class") != nullptr && strcmp(list_node->Attribute("Class"), "ProgressRenderer.MapComponent_RenderManager") == 0)
+			if(run_types[i] != EObstacleType::WALL || simplify_tolerance <= 0.0f)
 			{
-				this->image_pos = {
-					(s16_t)list_node->FirstChildElement("rsTargetStartX")->Int64Text(-1),
-					(s16_t)list_node->FirstChildElement("rsTargetStartZ")->Int64Text(-1)
-				};
-
-				const v2i_t end = {
-					(s16_t)list_node->FirstChildElement("rsTargetEndX")->Int64Text(-1),
-					(s16_t)list_node->FirstChildElement("rsTargetEndZ")->Int64Text(-1)
-				};
-
-				this->image_size = end - this->image_pos;
-				break;
+				this->graph[idx_next++] = obstacle_t({ { vertices[i], vertices[i + 1] }, run_types[i] });
+				i++;
+				continue;
 			}
-		}
-
-		cerr<<"image area: pos = {"<<this->image_pos[0]<<"; "<<this->image_pos[1]<<"}, size = {"<<this->image_size[0]<<"; "<<this->image_size[1]<<"}"<<endl;
-
-		EL_ERROR(this->image_size[0] > this->size[0] || this->image_size[1] > this->size[1], TException, "image size is bigger than map size");
 
-		unsigned n_walls = 0;
-		unsigned n_windows = 0;
-		unsigned n_doors = 0;
-		unsigned n_terrain = 0;
-		unsigned n_lights = 0;
+			usys_t j = i + 1;
+			while(j < n_runs && run_types[j] == EObstacleType::WALL && j != idx_split)
+				j++;
 
-		{
-			TList<u16_t> terrain_grid_data;
-			terrain_grid_data.Inflate(this->size[0] * this->size[1], 0);
+			simplified.clear();
+			SimplifyPolyline(&vertices[i], j - i + 1, simplify_tolerance, simplified);
+			for(usys_t k = 0; k + 1 < simplified.size(); k++)
+				this->graph[idx_next++] = obstacle_t({ { simplified[k], simplified[k + 1] }, EObstacleType::WALL });
+			i = j;
+		}
+	}
 
-			auto terrain_node = map_node->FirstChildElement("compressedThingMapDeflate");
-			EL_ERROR(terrain_node == nullptr, TException, "no <compressedThingMapDeflate> node found");
+	void TObstacleMap::AppendOutline(const vector<usys_t>& corners, const vector<u8_t>& directions, const v2f_t lo, const v2f_t hi, const float simplify_tolerance, usys_t& idx_next)
+	{
+		const usys_t n_edges = corners.size();
+		auto edge_type = [&](const usys_t idx_edge) { return this->types[this->CornerTile(corners[idx_edge], directions[idx_edge], true)]; };
+		auto is_break = [&](const usys_t idx_edge) {
+			const usys_t idx_prev = (idx_edge + n_edges - 1) % n_edges;
+			return directions[idx_edge] != directions[idx_prev] || edge_type(idx_edge) != edge_type(idx_prev);
+		};
 
-			TList<char> base64_data;
-			const char* base64_text_src = terrain_node->GetText();
-			for(const char* p = base64_text_src; *p != 0; p++)
-				if(IsBase64Char(*p))
-					base64_data.Append(*p);
+		// the edges run from corner to corner on the half-tile grid like the border of the rectangle => an edge is either
+		// completely within the rectangle (maybe on its border) or it is dropped
+		auto vertex = [&](const usys_t idx_edge) { return this->Center(corners[idx_edge % n_edges]) + direction::TILE[1]; };	// where the edge starts
+		auto is_inside = [&](const v2f_t pos) { return pos[0] >= lo[0] && pos[1] >= lo[1] && pos[0] <= hi[0] && pos[1] <= hi[1]; };
+		auto is_kept = [&](const usys_t idx_edge) { return is_inside(vertex(idx_edge)) && is_inside(vertex(idx_edge + 1)); };
 
-			TList<byte_t> raw_data;
-			raw_data.Append(0x78);
-			raw_data.Append(0x9c);
-			raw_data.Inflate(Base64decode_len(&base64_data[0]), 0);
-			int ret = Base64decode((char*)&raw_data[2], &base64_data[0]);
-			EL_ERROR(ret < 0 || ret > (int)raw_data.Count(), TLogicException);
-			raw_data.Cut(0, raw_data.Count() - ret);
-			base64_data.Clear();
+		usys_t idx_dropped = n_edges;
+		for(usys_t i = 0; i < n_edges && idx_dropped == n_edges; i++)
+			if(!is_kept(i))
+				idx_dropped = i;
 
-			unsigned long uncompressed_size = terrain_grid_data.Count() * 2;
-			uncompress((byte_t*)&terrain_grid_data[0], &uncompressed_size, (byte_t*)&raw_data[0], raw_data.Count());
-			EL_ERROR(uncompressed_size > terrain_grid_data.Count() * 2, TLogicException);
+		// vertices of the runs (and the end of the last one) and the type of the run starting at each of them
+		vector<v2f_t> vertices;
+		vector<EObstacleType> run_types;
 
-			for(s16_t y = 0; y < size[1]; y++)
+		if(idx_dropped < n_edges)
+		{
+			// the outline leaves the rectangle => every stretch of it within the rectangle becomes an open polyline,
+			// whose ends stay where they are when it is simplified
+			for(usys_t i = 1; i <= n_edges; i++)
 			{
-				for(s16_t x = 0; x < size[0]; x++)
+				const usys_t idx_edge = (idx_dropped + i) % n_edges;
+				const bool kept = is_kept(idx_edge);
+				if(kept && (run_types.empty() || is_break(idx_edge)))
 				{
-					if(terrain_grid_data[y * size[0] + x] != 0)
-					{
-						n_terrain++;
-						this->obstacle_map.PlaceObstacleAt({x,y}, EObstacleType::WALL);
-					}
+					vertices.push_back(vertex(idx_edge));
+					run_types.push_back(edge_type(idx_edge));
+				}
+				else if(!kept && !run_types.empty())
+				{
+					vertices.push_back(vertex(idx_edge));
+					this->AppendRuns(vertices, run_types, run_types.size(), simplify_tolerance, idx_next);
+					vertices.clear();
+					run_types.clear();
 				}
 			}
+			return;
+		}
+
+		// start at a corner of the outline (there are at least four), so the first and the last run are not the same
+		// preferably right after a door or window, so no wall is split in two by the start when it is simplified
+		usys_t idx_first = n_edges;
+		for(usys_t i = 0; i < n_edges && idx_first == n_edges; i++)
+			if(is_break(i) && edge_type((i + n_edges - 1) % n_edges) != EObstacleType::WALL)
+				idx_first = i;
+		if(idx_first == n_edges)
+		{
+			idx_first = 0;
+			while(!is_break(idx_first))
+				idx_first++;
 		}
 
-		for(auto thing_node = map_node->FirstChildElement("things")->FirstChildElement("thing"); thing_node != nullptr; thing_node = thing_node->	NextSiblingElement())
+		for(usys_t i = 0; i < n_edges; i++)
 		{
-			if(thing_node->Attribute("Class") != nullptr)
+			const usys_t idx_edge = (idx_first + i) % n_edges;
+			if(is_break(idx_edge))
 			{
-				const v2i_t pos = thing_node->FirstChildElement("pos")->GetText() != nullptr ? V2iFromRimworldPos(thing_node->FirstChildElement("pos")->GetText()) : v2i_t({0,0});
+				vertices.push_back(vertex(idx_edge));
+				run_types.push_back(edge_type(idx_edge));
+			}
+		}
+		vertices.push_back(vertices[0]);
 
-				if( strcmp(thing_node->Attribute("Class"), "Building") == 0 ||
-					strcmp(thing_node->Attribute("Class"), "Building_Door") == 0 ||
-					strcmp(thing_node->Attribute("Class"), "DubsBadHygiene.Building_StallDoor") == 0)
-				{
-					auto def_node = thing_node->FirstChildElement("def");
-					if(def_node != nullptr)
-					{
-						if(strcmp(def_node->GetText(), "Wall") == 0 || strcmp(def_node->GetText(), "RadiationShielding") == 0)
-						{
-							n_walls++;
-							this->obstacle_map.PlaceObstacleAt(pos, EObstacleType::WALL);
-						}
-						else if(strcmp(def_node->GetText(), "Door") == 0 || strcmp(def_node->GetText(), "ToiletStallDoor") == 0 || strcmp(def_node->GetText(), "DU_Blastdoor") == 0 || strcmp(def_node->GetText(), "Autodoor") == 0)
-						{
-							n_doors++;
-							this->obstacle_map.PlaceObstacleAt(pos, EObstacleType::DOOR);
-						}
-						else if(strcmp(def_node->GetText(), "ED_Embrasure") == 0)
+		// an outline consisting of walls only is split at the vertex furthest away from its first vertex
+		const usys_t n_runs = run_types.size();
+		usys_t idx_split = n_runs;
+		bool only_walls = true;
+		float max_distance = 0.0f;
+		for(usys_t i = 0; i < n_runs; i++)
+		{
+			only_walls &= run_types[i] == EObstacleType::WALL;
+			const float dx = vertices[i][0] - vertices[0][0];
+			const float dy = vertices[i][1] - vertices[0][1];
+			if(dx * dx + dy * dy > max_distance)
+			{
+				max_distance = dx * dx + dy * dy;
+				idx_split = i;
+			}
+		}
+
+		this->AppendRuns(vertices, run_types, only_walls ? idx_split : n_runs, simplify_tolerance, idx_next);
+	}
+
+	void TObstacleMap::ComputeContourGraph(const float simplify_tolerance, const v2f_t lo, const v2f_t hi)
+	{
+		this->graph.Clear();
+
+		// Marching squares over the corners of the tiles: every edge between an obstacle and a free tile is part of an
+		// outline. The edges are directed such that the obstacle is on their right (=> outer outlines run clockwise,
+		// holes counter-clockwise) and take the type of that obstacle. The edges inside a region of obstacles never
+		// show up, so a mountain only yields its outline (and the outlines of the caves in it).
+		// edges[corner] has bit d set if an edge leaves the corner in direction d (WEST, NORTH, EAST or SOUTH) and
+		// bit d + 1 once that edge was traced
+		static const u8_t MASK_EDGES = 0x55;
+		TList<u8_t> edges;
+		edges.Inflate(this->types.Count(), 0);
+
+		usys_t n_edges = 0;
+		for(s16_t y = 0; y <= this->size[1]; y++)
+			for(usys_t corner = this->Index({0,y}); corner <= this->Index({this->size[0],y}); corner++)
+				for(unsigned d = 0; d < direction::N; d += 2)
+					if(this->types[this->CornerTile(corner, d, true)] != EObstacleType::NONE && this->types[this->CornerTile(corner, d, false)] == EObstacleType::NONE)
+					{
+						edges[corner] |= 1 << d;
+						n_edges++;
+					}
+
+		// every segment covers at least one edge => the graph is sized once for the worst case and cut afterwards
+		SizeExactly(this->graph, n_edges, OBSTACLE_NONE);
+		usys_t idx_next = 0;
+
+		// start corners are picked in grid order, like the start tiles in ComputeObstacleGraph()
+		vector<usys_t> corners;
+		vector<u8_t> directions;
+		for(s16_t y = 0; y <= this->size[1]; y++)
+			for(usys_t start = this->Index({0,y}); start <= this->Index({this->size[0],y}); start++)
+				for(unsigned d = 0; d < direction::N; d += 2)
+				{
+					if((edges[start] & MASK_EDGES & ~(edges[start] >> 1) & (1 << d)) == 0)
+						continue;
+
+					corners.clear();
+					directions.clear();
+					usys_t corner = start;
+					unsigned current = d;
+					for(;;)
+					{
+						edges[corner] |= 1 << (current + 1);
+						corners.push_back(corner);
+						directions.push_back(current);
+						corner = this->Neighbor(corner, current);
+
+						// two edges leave a corner where obstacles touch diagonally - turning right keeps them apart
+						const u8_t mask = edges[corner] & MASK_EDGES;
+						const unsigned next = (mask & (mask - 1)) != 0 ? (current + 2) % direction::N : __builtin_ctz(mask);
+						if((edges[corner] >> (next + 1)) & 1)
+							break;	// back at the start of the outline
+						current = next;
+					}
+
+					this->AppendOutline(corners, directions, lo, hi, simplify_tolerance, idx_next);
+				}
+
+		this->graph.Cut(0, this->graph.Count() - idx_next);
+	}
+
+	TObstacleMap::TObstacleMap(const v2i_t origin, const v2i_t size) : origin(origin), size(size), stride(size[0] + 2)
+	{
+		for(unsigned i = 0; i < direction::N; i++)
+			this->offsets[i] = direction::MAP[i][1] * (ssys_t)this->stride + direction::MAP[i][0];
+
+		const usys_t n_tiles = this->stride * (size[1] + 2);
+		this->types.Inflate(n_tiles, EObstacleType::NONE);
+		this->masks_neighbor.Inflate(n_tiles, 0);
+		this->masks_processed.Inflate(n_tiles, 0);
+		this->n_cross_neighbors.Inflate(n_tiles, 0);
+	}
+
+	/****************************************************************************/
+
+	// Minimal streaming XML reader. It only supports what Rimworld writes into its savegames:
+	// elements, attributes, text, comments, CDATA and processing instructions.
+	// There is no DTD support and entities are not expanded (Rimworld does not use them where we look).
+	// Text and attribute values are passed to the handler as raw views into the input buffer.
+	// When reading from a FILE* these are only valid for the duration of the callback. When parsing a
+	// memory block (e.g. a TMapping of the savegame) the views point straight into it and stay valid
+	// as long as the memory block does.
+
+	struct sax_tag_t
+	{
+		string_view name;
+		string_view attributes;
+
+		bool Attribute(const string_view attribute_name, string_view& value) const;
+	};
+
+	class ISaxHandler
+	{
+		public:
+			// return false to skip the element and all its children without any further events
+			virtual bool OnStartElement(const sax_tag_t& tag) = 0;
+
+			// called with consecutive pieces of the text - a single text node can be split into multiple calls
+			virtual void OnText(const string_view text) = 0;
+
+			virtual void OnEndElement(const string_view name) = 0;
+	};
+
+	class TSaxParser
+	{
+		protected:
+			static const usys_t SZ_CHUNK = 1024 * 1024;
+
+			FILE* const file;
+			unique_ptr<char[]> buffer;
+			const char* data;	// either buffer.get() or the memory block we were constructed with
+			usys_t sz_buffer;
+			usys_t idx_begin;
+			usys_t idx_end;
+			bool eof;
+
+			usys_t Available() const { return this->idx_end - this->idx_begin; }
+			bool Refill();
+			usys_t MarkupLength();
+
+		public:
+			void Parse(ISaxHandler& handler);
+
+			TSaxParser(FILE* const file);
+			TSaxParser(const char* const data, const usys_t size);
+	};
+
+	/****************************************************************************/
+
+	static bool IsXmlSpace(const char chr)
+	{
+		return chr == ' ' || chr == '\t' || chr == '\r' || chr == '\n';
+	}
+
+	static string_view TrimXmlSpace(string_view str)
+	{
+		while(str.size() > 0 && IsXmlSpace(str.front()))
+			str.remove_prefix(1);
+		while(str.size() > 0 && IsXmlSpace(str.back()))
+			str.remove_suffix(1);
+		return str;
+	}
+
+	bool sax_tag_t::Attribute(const string_view attribute_name, string_view& value) const
+	{
+		string_view rest = this->attributes;
+		for(;;)
+		{
+			rest = TrimXmlSpace(rest);
+			const usys_t idx_eq = rest.find('=');
+			if(idx_eq == string_view::npos)
+				return false;
+
+			const string_view name = TrimXmlSpace(rest.substr(0, idx_eq));
+			rest = TrimXmlSpace(rest.substr(idx_eq + 1));
+			EL_ERROR(rest.size() == 0 || (rest[0] != '"' && rest[0] != '\''), TException, "malformed XML attribute");
+
+			const usys_t idx_quote = rest.find(rest[0], 1);
+			EL_ERROR(idx_quote == string_view::npos, TException, "unterminated XML attribute value");
+
+			if(name == attribute_name)
+			{
+				value = rest.substr(1, idx_quote - 1);
+				return true;
+			}
+
+			rest = rest.substr(idx_quote + 1);
+		}
+	}
+
+	bool TSaxParser::Refill()
+	{
+		if(this->eof)
+			return false;
+
+		if(this->idx_begin > 0)
+		{
+			memmove(this->buffer.get(), this->data + this->idx_begin, this->Available());
+			this->idx_end -= this->idx_begin;
+			this->idx_begin = 0;
+		}
+
+		if(this->idx_end == this->sz_buffer)
+		{
+			// a single markup token does not fit into the buffer => grow it
+			unique_ptr<char[]> new_buffer(new char[this->sz_buffer * 2]);
+			memcpy(new_buffer.get(), this->buffer.get(), this->idx_end);
+			this->buffer = move(new_buffer);
+			this->data = this->buffer.get();
+			this->sz_buffer *= 2;
+		}
+
+		const usys_t n_read = fread(this->buffer.get() + this->idx_end, 1, this->sz_buffer - this->idx_end, this->file);
+		EL_ERROR(ferror(this->file), TException, "error while reading savegame");
+		if(n_read == 0)
+		{
+			this->eof = true;
+			return false;
+		}
+
+		this->idx_end += n_read;
+		return true;
+	}
+
+	usys_t TSaxParser::MarkupLength()
+	{
+		// returns the length of the markup token at the current position (including the closing '>')
+		// refills the buffer until the whole token is available
+
+		usys_t n_scanned = 0;
+		for(;;)
+		{
+			const string_view window(this->data + this->idx_begin, this->Available());
+
+			string_view terminator = ">";
+			if(window.size() >= 4 && window.substr(0, 4) == "<!--")
+				terminator = "-->";
+			else if(window.size() >= 9 && window.substr(0, 9) == "<![CDATA[")
+				terminator = "]]>";
+			else if(window.size() >= 2 && window.substr(0, 2) == "<?")
+				terminator = "?>";
+
+			if(terminator == ">")
+			{
+				// regular tag - skip over quoted attribute values
+				char quote = 0;
+				for(usys_t i = 1; i < window.size(); i++)
+				{
+					const char chr = window[i];
+					if(quote != 0)
+					{
+						if(chr == quote)
+							quote = 0;
+					}
+					else if(chr == '"' || chr == '\'')
+						quote = chr;
+					else if(chr == '>')
+						return i + 1;
+				}
+			}
+			else
+			{
+				const usys_t idx_start = n_scanned > terminator.size() ? n_scanned - terminator.size() : 1;
+				const usys_t idx_terminator = window.find(terminator, idx_start);
+				if(idx_terminator != string_view::npos)
+					return idx_terminator + terminator.size();
+			}
+
+			n_scanned = window.size();
+			EL_ERROR(!this->Refill(), TException, "unexpected end of file inside XML markup");
+		}
+	}
+
+	void TSaxParser::Parse(ISaxHandler& handler)
+	{
+		unsigned skip_depth = 0;
+		unsigned depth = 0;
+
+		for(;;)
+		{
+			if(this->Available() == 0 && !this->Refill())
+				break;
+
+			const char* const p = this->data + this->idx_begin;
+
+			if(*p != '<')
+			{
+				const char* const lt = (const char*)memchr(p, '<', this->Available());
+				const usys_t len = lt != nullptr ? (usys_t)(lt - p) : this->Available();
+				if(skip_depth == 0 && depth > 0)
+					handler.OnText(string_view(p, len));
+				this->idx_begin += len;
+				continue;
+			}
+
+			const usys_t len = this->MarkupLength();
+			const string_view markup(this->data + this->idx_begin, len);
+			this->idx_begin += len;
+
+			if(markup.substr(0, 9) == "<![CDATA[")
+			{
+				if(skip_depth == 0 && depth > 0)
+					handler.OnText(markup.substr(9, len - 12));
+			}
+			else if(markup[1] == '!' || markup[1] == '?')
+			{
+				// comment, processing instruction or DOCTYPE => ignore
+			}
+			else if(markup[1] == '/')
+			{
+				EL_ERROR(depth == 0, TException, "unbalanced XML end tag");
+				depth--;
+				if(skip_depth > 0)
+					skip_depth--;
+				else
+					handler.OnEndElement(TrimXmlSpace(markup.substr(2, len - 3)));
+			}
+			else
+			{
+				const bool self_closing = markup[len - 2] == '/';
+				const string_view content = markup.substr(1, len - (self_closing ? 3 : 2));
+
+				usys_t idx_name_end = 0;
+				while(idx_name_end < content.size() && !IsXmlSpace(content[idx_name_end]))
+					idx_name_end++;
+
+				if(!self_closing)
+					depth++;
+
+				if(skip_depth > 0)
+				{
+					if(!self_closing)
+						skip_depth++;
+				}
+				else
+				{
+					const sax_tag_t tag = { content.substr(0, idx_name_end), content.substr(idx_name_end) };
+					if(!handler.OnStartElement(tag))
+					{
+						if(!self_closing)
+							skip_depth = 1;
+					}
+					else if(self_closing)
+						handler.OnEndElement(tag.name);
+				}
+			}
+		}
+
+		EL_ERROR(depth != 0, TException, "unexpected end of file (unclosed XML elements)");
+	}
+
+	TSaxParser::TSaxParser(FILE* const file) : file(file), buffer(new char[SZ_CHUNK]), data(buffer.get()), sz_buffer(SZ_CHUNK), idx_begin(0), idx_end(0), eof(false)
+	{
+	}
+
+	TSaxParser::TSaxParser(const char* const data, const usys_t size) : file(nullptr), buffer(nullptr), data(data), sz_buffer(size), idx_begin(0), idx_end(size), eof(true)
+	{
+	}
+
+	/****************************************************************************/
+
+	enum class EThingType : u8_t
+	{
+		IGNORE,
+		BUILDING,	// only during classification: the def decides
+		WALL,
+		DOOR,
+		WINDOW,
+		TERRAIN,
+		LAMP,
+		WALL_LIGHT
+	};
+
+	// only the things TMap actually uses are kept
+	struct thing_t
+	{
+		v2i_t pos;
+		u8_t rot;
+		EThingType type;
+		u16_t id_def;	// entry in TDefRegistry which decided the type
+	};
+
+	// Everything rim2vtt knows about the things in a savegame, keyed by their Class attribute or their def.
+	// Names are interned once into a flat array of def_t, so classifying a thing costs a single hash lookup
+	// and everything else about it (light, footprint) is an array access by its def id.
+	// The built-in entries can be extended or overridden with a registry file (--defs):
+	//
+	//   # comment
+	//   class <Class attribute> ignore|building|terrain|wall-light [options]
+	//   def <def name> ignore|wall|door|window|lamp [options]
+	//
+	// options: range=<tiles> (lights), color=RRGGBB or AARRGGBB (lights), size=<W>x<H> (footprint, unrotated)
+	// Things whose class maps to "building" are classified by their def, all others by their class alone.
+	class TDefRegistry
+	{
+		public:
+			enum class EKind : u8_t
+			{
+				CLASS,
+				DEF
+			};
+
+			struct def_t
+			{
+				string name;
+				EKind kind;
+				EThingType type;
+				u8_t footprint[2];
+				float light_range;
+				u32_t light_color;	// AARRGGBB as used by UVTT, 0 = let the VTT decide
+			};
+
+			static constexpr u16_t ID_NONE = (u16_t)-1;
+
+		protected:
+			struct builtin_t
+			{
+				EKind kind;
+				const char* name;
+				EThingType type;
+				float light_range;
+			};
+
+			vector<def_t> defs;	// indexed by def id
+			vector<u16_t> slots;	// open addressing over defs, ID_NONE marks an empty slot, always a power of 2 in size
+			u64_t fingerprint;
+
+			static const builtin_t BUILTIN[];
+
+			static u64_t Hash(const EKind kind, const string_view name);
+			void Rehash();
+			void UpdateFingerprint(const def_t& def);
+
+		public:
+			// returns the id of the entry, ID_NONE if there is none
+			u16_t Find(const EKind kind, const string_view name) const;
+			const def_t& Def(const u16_t id) const { return this->defs[id]; }
+
+			// adds an entry or replaces the existing entry for the same kind and name
+			u16_t Set(const def_t& def);
+			void LoadFile(const char* const path);
+
+			// changes whenever an entry changes - part of the cache key
+			u64_t Fingerprint() const { return this->fingerprint; }
+
+			// the registry used by all readers
+			static TDefRegistry& Instance();
+
+			TDefRegistry();
+	};
+
+	/****************************************************************************/
+
+	const TDefRegistry::builtin_t TDefRegistry::BUILTIN[] = {
+		{ EKind::CLASS, "Building", EThingType::BUILDING, 0 },
+		{ EKind::CLASS, "Building_Door", EThingType::BUILDING, 0 },
+		{ EKind::CLASS, "DubsBadHygiene.Building_StallDoor", EThingType::BUILDING, 0 },
+		{ EKind::CLASS, "Mineable", EThingType::TERRAIN, 0 },
+		{ EKind::CLASS, "MURWallLight.WallLight", EThingType::WALL_LIGHT, 6 },
+		{ EKind::DEF, "Wall", EThingType::WALL, 0 },
+		{ EKind::DEF, "RadiationShielding", EThingType::WALL, 0 },
+		{ EKind::DEF, "Door", EThingType::DOOR, 0 },
+		{ EKind::DEF, "ToiletStallDoor", EThingType::DOOR, 0 },
+		{ EKind::DEF, "DU_Blastdoor", EThingType::DOOR, 0 },
+		{ EKind::DEF, "Autodoor", EThingType::DOOR, 0 },
+		{ EKind::DEF, "ED_Embrasure", EThingType::WINDOW, 0 },
+		{ EKind::DEF, "TorchLamp", EThingType::LAMP, 4 }
+	};
+
+	u64_t TDefRegistry::Hash(const EKind kind, const string_view name)
+	{
+		// FNV-1a
+		u64_t hash = 0xcbf29ce484222325ULL ^ (u64_t)kind;
+		for(const char chr : name)
+			hash = (hash ^ (u8_t)chr) * 0x100000001b3ULL;
+		return hash;
+	}
+
+	u16_t TDefRegistry::Find(const EKind kind, const string_view name) const
+	{
+		const usys_t mask = this->slots.size() - 1;
+		for(usys_t idx_slot = Hash(kind, name) & mask;; idx_slot = (idx_slot + 1) & mask)
+		{
+			const u16_t id = this->slots[idx_slot];
+			if(id == ID_NONE)
+				return ID_NONE;
+
+			const def_t& def = this->defs[id];
+			if(def.kind == kind && def.name == name)
+				return id;
+		}
+	}
+
+	void TDefRegistry::Rehash()
+	{
+		// keep the load factor below 1/4 so misses (the vast majority of lookups) end quickly
+		usys_t n_slots = 16;
+		while(n_slots < this->defs.size() * 4)
+			n_slots *= 2;
+
+		this->slots.assign(n_slots, ID_NONE);
+		for(usys_t id = 0; id < this->defs.size(); id++)
+		{
+			usys_t idx_slot = Hash(this->defs[id].kind, this->defs[id].name) & (n_slots - 1);
+			while(this->slots[idx_slot] != ID_NONE)
+				idx_slot = (idx_slot + 1) & (n_slots - 1);
+			this->slots[idx_slot] = (u16_t)id;
+		}
+	}
+
+	void TDefRegistry::UpdateFingerprint(const def_t& def)
+	{
+		u64_t hash = Hash(def.kind, def.name);
+		u32_t light_range;
+		memcpy(&light_range, &def.light_range, sizeof(light_range));
+		for(const u64_t value : { (u64_t)def.type, (u64_t)def.footprint[0], (u64_t)def.footprint[1], (u64_t)light_range, (u64_t)def.light_color })
+			hash = (hash ^ value) * 0x100000001b3ULL;
+		this->fingerprint = (this->fingerprint ^ hash) * 0x100000001b3ULL;
+	}
+
+	u16_t TDefRegistry::Set(const def_t& def)
+	{
+		this->UpdateFingerprint(def);
+
+		u16_t id = this->Find(def.kind, def.name);
+		if(id != ID_NONE)
+		{
+			this->defs[id] = def;
+			return id;
+		}
+
+		EL_ERROR(this->defs.size() >= ID_NONE, TException, TString::Format("too many defs (limit: %d)", ID_NONE));
+		id = (u16_t)this->defs.size();
+		this->defs.push_back(def);
+		if(this->defs.size() * 4 > this->slots.size())
+			this->Rehash();
+		else
+		{
+			usys_t idx_slot = Hash(def.kind, def.name) & (this->slots.size() - 1);
+			while(this->slots[idx_slot] != ID_NONE)
+				idx_slot = (idx_slot + 1) & (this->slots.size() - 1);
+			this->slots[idx_slot] = id;
+		}
+
+		return id;
+	}
+
+	void TDefRegistry::LoadFile(const char* const path)
+	{
+		static const struct { const char* name; EKind kind; EThingType type; } ACTIONS[] = {
+			{ "ignore", EKind::CLASS, EThingType::IGNORE },
+			{ "building", EKind::CLASS, EThingType::BUILDING },
+			{ "terrain", EKind::CLASS, EThingType::TERRAIN },
+			{ "wall-light", EKind::CLASS, EThingType::WALL_LIGHT },
+			{ "ignore", EKind::DEF, EThingType::IGNORE },
+			{ "wall", EKind::DEF, EThingType::WALL },
+			{ "door", EKind::DEF, EThingType::DOOR },
+			{ "window", EKind::DEF, EThingType::WINDOW },
+			{ "lamp", EKind::DEF, EThingType::LAMP }
+		};
+
+		ifstream is(path);
+		EL_ERROR(!is.is_open(), TException, TString::Format("unable to open defs file %q", path));
+
+		string line;
+		for(unsigned line_number = 1; getline(is, line); line_number++)
+		{
+			istringstream fields(line);
+			string kind_name, action;
+			def_t def = { string(), EKind::DEF, EThingType::IGNORE, { 1, 1 }, 0, 0 };
+			if(!(fields>>kind_name) || kind_name[0] == '#')
+				continue;
+
+			EL_ERROR(kind_name != "class" && kind_name != "def", TException, TString::Format("defs file line %d: expected \"class\" or \"def\"", line_number));
+			EL_ERROR(!(fields>>def.name>>action), TException, TString::Format("defs file line %d does not have the format \"class|def <name> <action> [options]\"", line_number));
+			def.kind = kind_name == "class" ? EKind::CLASS : EKind::DEF;
+
+			bool found = false;
+			for(const auto& a : ACTIONS)
+				if(a.kind == def.kind && action == a.name)
+				{
+					def.type = a.type;
+					found = true;
+					break;
+				}
+			EL_ERROR(!found, TException, TString::Format("defs file line %d: unknown action %q for a %s", line_number, action.c_str(), kind_name.c_str()));
+
+			string option;
+			while(fields>>option)
+			{
+				const usys_t idx_eq = option.find('=');
+				const string key = option.substr(0, idx_eq);
+				const char* const value = idx_eq != string::npos ? option.c_str() + idx_eq + 1 : "";
+				char* end = nullptr;
+				unsigned w = 0, h = 0;
+				int n_chars = 0;
+
+				if(key == "range")
+				{
+					def.light_range = strtof(value, &end);
+					EL_ERROR(end == value || *end != 0 || def.light_range < 0, TException, TString::Format("defs file line %d: invalid range %q", line_number, value));
+				}
+				else if(key == "color")
+				{
+					// from_chars() takes hex digits only (strtoul() would also take whitespace, a sign or a 0x prefix)
+					const usys_t n_digits = strlen(value);
+					const from_chars_result result = from_chars(value, value + n_digits, def.light_color, 16);
+					EL_ERROR(result.ec != errc() || result.ptr != value + n_digits || (n_digits != 6 && n_digits != 8), TException, TString::Format("defs file line %d: invalid color %q (expected RRGGBB or AARRGGBB)", line_number, value));
+					if(n_digits == 6)
+						def.light_color |= 0xff000000;
+				}
+				else if(key == "size")
+				{
+					EL_ERROR(sscanf(value, "%ux%u%n", &w, &h, &n_chars) != 2 || value[n_chars] != 0 || w < 1 || h < 1 || w > 255 || h > 255, TException, TString::Format("defs file line %d: invalid size %q (expected <W>x<H>)", line_number, value));
+					def.footprint[0] = (u8_t)w;
+					def.footprint[1] = (u8_t)h;
+				}
+				else
+					EL_THROW(TException, TString::Format("defs file line %d: unknown option %q", line_number, option.c_str()));
+			}
+
+			this->Set(def);
+		}
+	}
+
+	TDefRegistry& TDefRegistry::Instance()
+	{
+		static TDefRegistry instance;
+		return instance;
+	}
+
+	TDefRegistry::TDefRegistry() : fingerprint(0)
+	{
+		this->Rehash();
+		for(const builtin_t& builtin : BUILTIN)
+			this->Set(def_t({ builtin.name, builtin.kind, builtin.type, { 1, 1 }, builtin.light_range, 0 }));
+	}
+
+	/****************************************************************************/
+
+	// everything rim2vtt needs to know about a map - collected by TSavegameReader
+	struct savegame_map_t
+	{
+		u64_t id;
+		v2i_t size;
+		v2i_t image_pos;
+		v2i_t image_end;
+		bool has_image_area;
+		bool has_thing_map;
+		string_view thing_map_b64;	// points into the mapped savegame, empty if thing_map_copy is used
+		string thing_map_copy;	// only used when the savegame could not be mapped
+		vector<thing_t> things;	// room for one per tile is reserved up-front (see TSavegameReader::OnStartElement())
+
+		string_view ThingMapBase64() const { return this->thing_map_b64.data() != nullptr ? this->thing_map_b64 : string_view(this->thing_map_copy); }
+
+		savegame_map_t() : id(0), size({0,0}), image_pos({0,0}), image_end({0,0}), has_image_area(false), has_thing_map(false) {}
+	};
+
+	class TSavegameReader : public ISaxHandler
+	{
+		protected:
+			enum class ENode : u8_t
+			{
+				IGNORE,
+				ROOT,
+				SAVEGAME,
+				GAME,
+				MAPS,
+				MAP,
+				MAP_ID,
+				MAP_INFO,
+				MAP_SIZE,
+				COMPONENTS,
+				RENDER_MANAGER,
+				RS_START_X,
+				RS_START_Z,
+				RS_END_X,
+				RS_END_Z,
+				THING_MAP,
+				THINGS,
+				THING,
+				THING_DEF,
+				THING_POS,
+				THING_ROT
+			};
+
+			static const unsigned MAX_DEPTH = 8;
+
+			ENode path[MAX_DEPTH];
+			unsigned depth;
+			unsigned idx_next_map;
+			const unsigned idx_wanted_map;
+			const bool persistent_input;
+			const TDefRegistry& registry;
+			bool found_map;
+			string_view text;
+			string text_copy;
+			thing_t thing;
+			string_view thing_def;
+			string thing_def_copy;
+
+			void AppendText(string_view& text, string& copy, const string_view piece) const;
+			ENode Child(const ENode parent, const sax_tag_t& tag);
+
+		public:
+			savegame_map_t map;
+
+			bool FoundMap() const { return this->found_map; }
+
+			bool OnStartElement(const sax_tag_t& tag) final override;
+			void OnText(const string_view text) final override;
+			void OnEndElement(const string_view name) final override;
+
+			// set persistent_input if the text views passed by the parser stay valid after the callback returns
+			// set map_fragment if the input is just a single map's <li> element cut out of the savegame (see TMapLocator)
+			TSavegameReader(const unsigned idx_wanted_map = 0, const bool persistent_input = false, const bool map_fragment = false);
+	};
+
+	// Finds the byte ranges of all maps (<savegame><game><maps><li>) in an in-place parsed savegame.
+	// Each range can then be parsed on its own by a TSavegameReader in map_fragment mode.
+	class TMapLocator : public ISaxHandler
+	{
+		protected:
+			unsigned depth;
+			const char* const end;
+			const char* map_begin;
+
+		public:
+			TList<string_view> maps;
+
+			bool OnStartElement(const sax_tag_t& tag) final override;
+			void OnText(const string_view text) final override {}
+			void OnEndElement(const string_view name) final override;
+
+			// end must point to the end of the memory block the parser works on
+			TMapLocator(const char* const end);
+	};
+
+	/****************************************************************************/
+
+	TSavegameReader::ENode TSavegameReader::Child(const ENode parent, const sax_tag_t& tag)
+	{
+		const string_view& name = tag.name;
+
+		switch(parent)
+		{
+			case ENode::ROOT:
+				return name == "savegame" ? ENode::SAVEGAME : ENode::IGNORE;
+
+			case ENode::SAVEGAME:
+				return name == "game" ? ENode::GAME : ENode::IGNORE;
+
+			case ENode::GAME:
+				return name == "maps" ? ENode::MAPS : ENode::IGNORE;
+
+			case ENode::MAPS:
+				if(name == "li")
+					return (this->idx_next_map++ == this->idx_wanted_map) ? ENode::MAP : ENode::IGNORE;
+				return ENode::IGNORE;
+
+			case ENode::MAP:
+				if(name == "uniqueID") return ENode::MAP_ID;
+				if(name == "mapInfo") return ENode::MAP_INFO;
+				if(name == "components") return ENode::COMPONENTS;
+				if(name == "compressedThingMapDeflate") return ENode::THING_MAP;
+				if(name == "things") return ENode::THINGS;
+				return ENode::IGNORE;
+
+			case ENode::MAP_INFO:
+				return name == "size" ? ENode::MAP_SIZE : ENode::IGNORE;
+
+			case ENode::COMPONENTS:
+			{
+				string_view cls;
+				if(name == "li" && tag.Attribute("Class", cls) && cls == "ProgressRenderer.MapComponent_RenderManager")
+					return ENode::RENDER_MANAGER;
+				return ENode::IGNORE;
+			}
+
+			case ENode::RENDER_MANAGER:
+				if(name == "rsTargetStartX") return ENode::RS_START_X;
+				if(name == "rsTargetStartZ") return ENode::RS_START_Z;
+				if(name == "rsTargetEndX") return ENode::RS_END_X;
+				if(name == "rsTargetEndZ") return ENode::RS_END_Z;
+				return ENode::IGNORE;
+
+			case ENode::THINGS:
+			{
+				string_view cls;
+				if(name != "thing" || !tag.Attribute("Class", cls))
+					return ENode::IGNORE;
+
+				this->thing.id_def = this->registry.Find(TDefRegistry::EKind::CLASS, cls);
+				if(this->thing.id_def == TDefRegistry::ID_NONE || this->registry.Def(this->thing.id_def).type == EThingType::IGNORE)
+					return ENode::IGNORE;
+				this->thing.type = this->registry.Def(this->thing.id_def).type;
+
+				this->thing.pos = {0,0};
+				this->thing.rot = 0;
+				this->thing_def = string_view();
+				return ENode::THING;
+			}
+
+			case ENode::THING:
+				if(name == "def") return ENode::THING_DEF;
+				if(name == "pos") return ENode::THING_POS;
+				if(name == "rot") return ENode::THING_ROT;
+				return ENode::IGNORE;
+
+			default:
+				return ENode::IGNORE;
+		}
+	}
+
+	void TSavegameReader::AppendText(string_view& text, string& copy, const string_view piece) const
+	{
+		if(this->persistent_input && (text.data() == nullptr || text.data() + text.size() == piece.data()))
+		{
+			// zero-copy: just extend the view into the input
+			text = string_view(text.data() == nullptr ? piece.data() : text.data(), text.size() + piece.size());
+		}
+		else
+		{
+			if(text.data() != copy.data())
+				copy.assign(text);
+			copy.append(piece);
+			text = copy;
+		}
+	}
+
+	bool TSavegameReader::OnStartElement(const sax_tag_t& tag)
+	{
+		const ENode node = this->Child(this->path[this->depth], tag);
+		if(node == ENode::IGNORE)
+			return false;
+
+		EL_ERROR(this->depth + 1 >= MAX_DEPTH, TLogicException);
+		this->path[++this->depth] = node;
+		this->text = string_view();
+		this->text_copy.clear();
+
+		if(node == ENode::THING_MAP)
+			this->map.has_thing_map = true;
+
+		// the kept things are buildings, which rarely share a tile => the size of the map (which comes before the
+		// things in a savegame) is enough room for them, the pages beyond the actual things are never touched
+		// the largest maps Rimworld creates are 1000x1000 tiles, anything bigger only gets that much up-front
+		static const usys_t MAX_RESERVED_THINGS = 1000 * 1000;
+		if(node == ENode::THINGS && this->map.size[0] > 0 && this->map.size[1] > 0)
+			this->map.things.reserve(min((usys_t)this->map.size[0] * (usys_t)this->map.size[1], MAX_RESERVED_THINGS));
+
+		return true;
+	}
+
+	void TSavegameReader::OnText(const string_view text)
+	{
+		switch(this->path[this->depth])
+		{
+			case ENode::THING_MAP:
+				this->AppendText(this->map.thing_map_b64, this->map.thing_map_copy, text);
+				break;
+
+			case ENode::MAP_ID:
+			case ENode::MAP_SIZE:
+			case ENode::RS_START_X:
+			case ENode::RS_START_Z:
+			case ENode::RS_END_X:
+			case ENode::RS_END_Z:
+			case ENode::THING_DEF:
+			case ENode::THING_POS:
+			case ENode::THING_ROT:
+				this->AppendText(this->text, this->text_copy, text);
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	void TSavegameReader::OnEndElement(const string_view name)
+	{
+		switch(this->path[this->depth])
+		{
+			case ENode::MAP:
+				this->found_map = true;
+				break;
+
+			case ENode::MAP_ID:
+				this->map.id = ParseInteger(this->text);
+				break;
+
+			case ENode::MAP_SIZE:
+				this->map.size = V2iFromRimworldPos(this->text);
+				break;
+
+			case ENode::THING_MAP:
+				if(this->map.thing_map_b64.data() == this->map.thing_map_copy.data())
+					this->map.thing_map_b64 = string_view();
+				break;
+
+			case ENode::RENDER_MANAGER:
+				this->map.has_image_area = true;
+				break;
+
+			case ENode::RS_START_X: this->map.image_pos[0] = (s16_t)ParseInteger(this->text); break;
+			case ENode::RS_START_Z: this->map.image_pos[1] = (s16_t)ParseInteger(this->text); break;
+			case ENode::RS_END_X:   this->map.image_end[0] = (s16_t)ParseInteger(this->text); break;
+			case ENode::RS_END_Z:   this->map.image_end[1] = (s16_t)ParseInteger(this->text); break;
+
+			case ENode::THING_DEF:
+				if(this->text.data() == this->text_copy.data())
+				{
+					this->thing_def_copy.assign(this->text);
+					this->thing_def = TrimXmlSpace(this->thing_def_copy);
+				}
+				else
+					this->thing_def = TrimXmlSpace(this->text);
+				break;
+
+			case ENode::THING_POS:
+				if(TrimXmlSpace(this->text).size() > 0)
+					this->thing.pos = V2iFromRimworldPos(this->text);
+				break;
+
+			case ENode::THING_ROT:
+				this->thing.rot = (u8_t)ParseInteger(this->text);
+				break;
+
+			case ENode::THING:
+				if(this->thing.type == EThingType::BUILDING)
+				{
+					this->thing.id_def = this->registry.Find(TDefRegistry::EKind::DEF, this->thing_def);
+					this->thing.type = this->thing.id_def != TDefRegistry::ID_NONE ? this->registry.Def(this->thing.id_def).type : EThingType::IGNORE;
+				}
+				if(this->thing.type != EThingType::IGNORE)
+					this->map.things.push_back(this->thing);
+				break;
+
+			default:
+				break;
+		}
+
+		this->depth--;
+	}
+
+	TSavegameReader::TSavegameReader(const unsigned idx_wanted_map, const bool persistent_input, const bool map_fragment) : depth(0), idx_next_map(0), idx_wanted_map(idx_wanted_map), persistent_input(persistent_input), registry(TDefRegistry::Instance()), found_map(false)
+	{
+		this->path[0] = map_fragment ? ENode::MAPS : ENode::ROOT;
+	}
+
+	/****************************************************************************/
+
+	bool TMapLocator::OnStartElement(const sax_tag_t& tag)
+	{
+		switch(this->depth)
+		{
+			case 0: if(tag.name != "savegame") return false; break;
+			case 1: if(tag.name != "game") return false; break;
+			case 2: if(tag.name != "maps") return false; break;
+			case 3:
+				if(tag.name != "li")
+					return false;
+				this->map_begin = tag.name.data() - 1;	// '<'
+				break;
+			default: return false;	// do not descend into the maps
+		}
+
+		this->depth++;
+		return true;
+	}
+
+	void TMapLocator::OnEndElement(const string_view name)
+	{
+		this->depth--;
+		if(this->depth == 3)
+		{
+			const char* const map_end = (const char*)memchr(name.data() + name.size(), '>', this->end - (name.data() + name.size()));
+			EL_ERROR(map_end == nullptr, TLogicException);
+			this->maps.Append(string_view(this->map_begin, map_end + 1 - this->map_begin));
+		}
+	}
+
+	TMapLocator::TMapLocator(const char* const end) : depth(0), end(end), map_begin(nullptr)
+	{
+	}
+
+	/****************************************************************************/
+
+	// Base64 decoder for the savegame's compressedThingMapDeflate text.
+	// Whitespace (Rimworld inserts line breaks) is skipped on the fly, so the text can be decoded
+	// straight from the savegame without a filtered copy. Runs of plain base64 characters are decoded
+	// with SSSE3/AVX2 when the CPU supports it, everything else goes through the scalar path.
+	class TBase64Decoder
+	{
+		protected:
+			// decodes whole vector blocks until it hits a non-base64 character or runs out of space
+			// returns the number of input characters consumed (always a multiple of 4)
+			typedef usys_t (*decode_blocks_fn)(const char* const src, const usys_t n_src, byte_t* const dst, const usys_t sz_dst);
+
+			static const decode_blocks_fn DECODE_BLOCKS;
+			static decode_blocks_fn SelectDecodeBlocks();
+
+			u32_t accumulator;
+			u8_t n_pending;
+			bool finished;
+
+		public:
+			// enough space to decode n_src characters in one go (includes slack for the vector stores)
+			static usys_t MaxDecodedSize(const usys_t n_src) { return n_src / 4 * 3 + 3 + 32; }
+
+			bool Finished() const { return this->finished; }
+
+			// decodes as much of src as fits into dst and removes the consumed characters from src
+			// returns the number of bytes written to dst
+			usys_t Decode(string_view& src, byte_t* const dst, const usys_t sz_dst);
+
+			// call at the end of the input - flushes the remaining bits of unpadded input (writes up to 2 bytes)
+			usys_t Finish(byte_t* const dst);
+
+			TBase64Decoder() : accumulator(0), n_pending(0), finished(false) {}
+	};
+
+	/****************************************************************************/
+
+	namespace base64
+	{
+		static const u8_t PAD = 64;
+		static const u8_t SPACE = 65;
+		static const u8_t INVALID = 255;
+
+		struct decode_table_t
+		{
+			u8_t value[256];
+
+			constexpr decode_table_t() : value()
+			{
+				for(unsigned i = 0; i < 256; i++)
+					value[i] = INVALID;
+				for(unsigned i = 0; i < 26; i++)
+				{
+					value['A' + i] = i;
+					value['a' + i] = 26 + i;
+				}
+				for(unsigned i = 0; i < 10; i++)
+					value['0' + i] = 52 + i;
+				value['+'] = 62;
+				value['/'] = 63;
+				value['='] = PAD;
+				value[' '] = value['\t'] = value['\r'] = value['\n'] = SPACE;
+			}
+		};
+
+		static constexpr decode_table_t DECODE_TABLE;
+
+		static usys_t DecodeBlocksScalar(const char* const, const usys_t, byte_t* const, const usys_t)
+		{
+			return 0;
+		}
+
+#if defined(__x86_64__)
+		// vector decoding after Wojciech Muła's "Base64 decoding with SIMD instructions"
+
+		__attribute__((target("ssse3")))
+		static usys_t DecodeBlocksSSSE3(const char* const src, const usys_t n_src, byte_t* const dst, const usys_t sz_dst)
+		{
+			const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+			const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+			const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+			const __m128i pack_shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+			const __m128i mask_nibble = _mm_set1_epi8(0x0f);
+			const __m128i mask_slash = _mm_set1_epi8(0x2f);
+
+			usys_t n_consumed = 0;
+			usys_t n_written = 0;
+			while(n_src - n_consumed >= 16 && sz_dst - n_written >= 16)
+			{
+				const __m128i in = _mm_loadu_si128((const __m128i*)(src + n_consumed));
+				const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_nibble);
+				const __m128i lo_nibbles = _mm_and_si128(in, mask_nibble);
+				const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+				const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+				if(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+					break;
+
+				const __m128i eq_slash = _mm_cmpeq_epi8(in, mask_slash);
+				const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_slash, hi_nibbles));
+				const __m128i values = _mm_add_epi8(in, roll);
+
+				const __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+				const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+				_mm_storeu_si128((__m128i*)(dst + n_written), _mm_shuffle_epi8(packed, pack_shuffle));
+
+				n_consumed += 16;
+				n_written += 12;
+			}
+
+			return n_consumed;
+		}
+
+		__attribute__((target("avx2")))
+		static usys_t DecodeBlocksAVX2(const char* const src, const usys_t n_src, byte_t* const dst, const usys_t sz_dst)
+		{
+			const __m256i lut_lo = _mm256_setr_epi8(
+				0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+				0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+			const __m256i lut_hi = _mm256_setr_epi8(
+				0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+				0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+			const __m256i lut_roll = _mm256_setr_epi8(
+				0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+				0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+			const __m256i pack_shuffle = _mm256_setr_epi8(
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+			const __m256i pack_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+			const __m256i mask_nibble = _mm256_set1_epi8(0x0f);
+			const __m256i mask_slash = _mm256_set1_epi8(0x2f);
+
+			usys_t n_consumed = 0;
+			usys_t n_written = 0;
+			while(n_src - n_consumed >= 32 && sz_dst - n_written >= 32)
+			{
+				const __m256i in = _mm256_loadu_si256((const __m256i*)(src + n_consumed));
+				const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_nibble);
+				const __m256i lo_nibbles = _mm256_and_si256(in, mask_nibble);
+				const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+				const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+				if(!_mm256_testz_si256(lo, hi))
+					break;
+
+				const __m256i eq_slash = _mm256_cmpeq_epi8(in, mask_slash);
+				const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_slash, hi_nibbles));
+				const __m256i values = _mm256_add_epi8(in, roll);
+
+				const __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+				const __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+				const __m256i shuffled = _mm256_shuffle_epi8(packed, pack_shuffle);
+				_mm256_storeu_si256((__m256i*)(dst + n_written), _mm256_permutevar8x32_epi32(shuffled, pack_lanes));
+
+				n_consumed += 32;
+				n_written += 24;
+			}
+
+			return n_consumed;
+		}
+#endif
+	}
+
+	TBase64Decoder::decode_blocks_fn TBase64Decoder::SelectDecodeBlocks()
+	{
+#if defined(__x86_64__)
+		if(__builtin_cpu_supports("avx2"))
+			return &base64::DecodeBlocksAVX2;
+		if(__builtin_cpu_supports("ssse3"))
+			return &base64::DecodeBlocksSSSE3;
+#endif
+		return &base64::DecodeBlocksScalar;
+	}
+
+	const TBase64Decoder::decode_blocks_fn TBase64Decoder::DECODE_BLOCKS = TBase64Decoder::SelectDecodeBlocks();
+
+	usys_t TBase64Decoder::Decode(string_view& src, byte_t* const dst, const usys_t sz_dst)
+	{
+		const char* p = src.data();
+		const char* const end = p + src.size();
+		usys_t n_written = 0;
+
+		while(p < end && !this->finished)
+		{
+			if(this->n_pending == 0)
+			{
+				const usys_t n_consumed = DECODE_BLOCKS(p, end - p, dst + n_written, sz_dst - n_written);
+				p += n_consumed;
+				n_written += n_consumed / 4 * 3;
+				if(p == end)
+					break;
+			}
+
+			if(sz_dst - n_written < 3)
+				break;
+
+			const u8_t value = base64::DECODE_TABLE.value[(u8_t)*p];
+			if(value < 64)
+			{
+				this->accumulator = (this->accumulator << 6) | value;
+				if(++this->n_pending == 4)
+				{
+					dst[n_written++] = (byte_t)(this->accumulator >> 16);
+					dst[n_written++] = (byte_t)(this->accumulator >> 8);
+					dst[n_written++] = (byte_t)(this->accumulator);
+					this->accumulator = 0;
+					this->n_pending = 0;
+				}
+			}
+			else if(value == base64::PAD)
+			{
+				n_written += this->Finish(dst + n_written);
+			}
+			else
+				EL_ERROR(value != base64::SPACE, TException, TString::Format("invalid character in base64 data (code: %d)", (u8_t)*p));
+
+			p++;
+		}
+
+		src = string_view(p, end - p);
+		return n_written;
+	}
+
+	usys_t TBase64Decoder::Finish(byte_t* const dst)
+	{
+		if(this->finished)
+			return 0;
+
+		this->finished = true;
+		switch(this->n_pending)
+		{
+			case 0:
+				return 0;
+
+			case 2:
+				dst[0] = (byte_t)(this->accumulator >> 4);
+				return 1;
+
+			case 3:
+				dst[0] = (byte_t)(this->accumulator >> 10);
+				dst[1] = (byte_t)(this->accumulator >> 2);
+				return 2;
+
+			default:
+				EL_THROW(TException, "truncated base64 data");
+		}
+	}
+
+	/****************************************************************************/
+
+	// Base64 encoder for the embedded map image. Works on chunks, so the image can be encoded and
+	// written out piece by piece. Uses SSSE3/AVX2 when the CPU supports it.
+	class TBase64Encoder
+	{
+		protected:
+			// encodes whole vector blocks, returns the number of input bytes consumed (always a multiple of 3)
+			typedef usys_t (*encode_blocks_fn)(const byte_t* const src, const usys_t n_src, char* const dst);
+
+			static const encode_blocks_fn ENCODE_BLOCKS;
+			static encode_blocks_fn SelectEncodeBlocks();
+
+		public:
+			static usys_t EncodedSize(const usys_t n_src) { return (n_src + 2) / 3 * 4; }
+
+			// encodes n_src bytes into dst (which must hold EncodedSize(n_src) chars) and returns the number of chars written
+			// padding is only added if n_src is not a multiple of 3 => use chunks of a multiple of 3 for all but the last call
+			static usys_t Encode(const byte_t* const src, const usys_t n_src, char* const dst);
+	};
+
+	/****************************************************************************/
+
+	namespace base64
+	{
+		static const char ENCODE_TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		static usys_t EncodeBlocksScalar(const byte_t* const, const usys_t, char* const)
+		{
+			return 0;
+		}
+
+#if defined(__x86_64__)
+		// vector encoding after Wojciech Muła's "Base64 encoding with SIMD instructions"
+
+		__attribute__((target("ssse3")))
+		static __m128i EncodeLookupSSSE3(const __m128i indices)
+		{
+			const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+			__m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+			const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+			result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+			return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+		}
+
+		__attribute__((target("ssse3")))
+		static usys_t EncodeBlocksSSSE3(const byte_t* const src, const usys_t n_src, char* const dst)
+		{
+			const __m128i split_shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+
+			usys_t n_consumed = 0;
+			usys_t n_written = 0;
+
+			// each step consumes 12 bytes but loads 16
+			while(n_src - n_consumed >= 16)
+			{
+				const __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + n_consumed)), split_shuffle);
+				const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+				const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+				_mm_storeu_si128((__m128i*)(dst + n_written), EncodeLookupSSSE3(_mm_or_si128(t0, t1)));
+
+				n_consumed += 12;
+				n_written += 16;
+			}
+
+			return n_consumed;
+		}
+
+		__attribute__((target("avx2")))
+		static usys_t EncodeBlocksAVX2(const byte_t* const src, const usys_t n_src, char* const dst)
+		{
+			const __m256i split_shuffle = _mm256_set_epi8(
+				10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+				10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+			const __m256i shift_lut = _mm256_setr_epi8(
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+			usys_t n_consumed = 0;
+			usys_t n_written = 0;
+
+			// each step consumes 24 bytes (12 per lane) but loads 28
+			while(n_src - n_consumed >= 28)
+			{
+				const __m128i lo = _mm_loadu_si128((const __m128i*)(src + n_consumed));
+				const __m128i hi = _mm_loadu_si128((const __m128i*)(src + n_consumed + 12));
+				const __m256i in = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), split_shuffle);
+				const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+				const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+				const __m256i indices = _mm256_or_si256(t0, t1);
+
+				__m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+				const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+				result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+				result = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), indices);
+				_mm256_storeu_si256((__m256i*)(dst + n_written), result);
+
+				n_consumed += 24;
+				n_written += 32;
+			}
+
+			return n_consumed;
+		}
+#endif
+	}
+
+	TBase64Encoder::encode_blocks_fn TBase64Encoder::SelectEncodeBlocks()
+	{
+#if defined(__x86_64__)
+		if(__builtin_cpu_supports("avx2"))
+			return &base64::EncodeBlocksAVX2;
+		if(__builtin_cpu_supports("ssse3"))
+			return &base64::EncodeBlocksSSSE3;
+#endif
+		return &base64::EncodeBlocksScalar;
+	}
+
+	const TBase64Encoder::encode_blocks_fn TBase64Encoder::ENCODE_BLOCKS = TBase64Encoder::SelectEncodeBlocks();
+
+	usys_t TBase64Encoder::Encode(const byte_t* const src, const usys_t n_src, char* const dst)
+	{
+		usys_t i = ENCODE_BLOCKS(src, n_src, dst);
+		char* p = dst + i / 3 * 4;
+
+		for(; i + 3 <= n_src; i += 3)
+		{
+			const u32_t triple = ((u32_t)src[i] << 16) | ((u32_t)src[i + 1] << 8) | src[i + 2];
+			*p++ = base64::ENCODE_TABLE[(triple >> 18) & 0x3f];
+			*p++ = base64::ENCODE_TABLE[(triple >> 12) & 0x3f];
+			*p++ = base64::ENCODE_TABLE[(triple >>  6) & 0x3f];
+			*p++ = base64::ENCODE_TABLE[triple & 0x3f];
+		}
+
+		if(i < n_src)
+		{
+			const u32_t triple = ((u32_t)src[i] << 16) | (i + 1 < n_src ? ((u32_t)src[i + 1] << 8) : 0);
+			*p++ = base64::ENCODE_TABLE[(triple >> 18) & 0x3f];
+			*p++ = base64::ENCODE_TABLE[(triple >> 12) & 0x3f];
+			*p++ = i + 1 < n_src ? base64::ENCODE_TABLE[(triple >> 6) & 0x3f] : '=';
+			*p++ = '=';
+		}
+
+		return p - dst;
+	}
+
+	/****************************************************************************/
+
+	// raw deflate stream (no zlib header or checksum) as written by Rimworld
+	struct TRawInflateStream
+	{
+		z_stream zs;
+
+		TRawInflateStream() : zs()
+		{
+			EL_ERROR(inflateInit2(&zs, -MAX_WBITS) != Z_OK, TException, "unable to initialize zlib");
+		}
+
+		~TRawInflateStream()
+		{
+			inflateEnd(&zs);
+		}
+	};
+
+	struct TRawDeflateStream
+	{
+		z_stream zs;
+
+		TRawDeflateStream(const int level) : zs()
+		{
+			EL_ERROR(deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK, TException, "unable to initialize zlib");
+		}
+
+		~TRawDeflateStream()
+		{
+			deflateEnd(&zs);
+		}
+	};
+
+	/****************************************************************************/
+
+	// blocking FIFO with a fixed capacity - Push() waits while the queue is full, which is what
+	// gives the producer backpressure
+	template<typename T>
+	class TBoundedQueue
+	{
+		protected:
+			mutex mtx;
+			condition_variable cv_not_empty;
+			condition_variable cv_not_full;
+			deque<T> items;
+			const usys_t capacity;
+			bool closed;
+
+		public:
+			// returns false if the queue was closed
+			bool Push(T item)
+			{
+				unique_lock<mutex> lock(this->mtx);
+				this->cv_not_full.wait(lock, [this]() { return this->closed || this->items.size() < this->capacity; });
+				if(this->closed)
+					return false;
+				this->items.push_back(move(item));
+				this->cv_not_empty.notify_one();
+				return true;
+			}
+
+			// returns false if the queue is full or closed
+			bool TryPush(T& item)
+			{
+				lock_guard<mutex> lock(this->mtx);
+				if(this->closed || this->items.size() >= this->capacity)
+					return false;
+				this->items.push_back(move(item));
+				this->cv_not_empty.notify_one();
+				return true;
+			}
+
+			// returns false once the queue is closed and empty
+			bool Pop(T& item)
+			{
+				unique_lock<mutex> lock(this->mtx);
+				this->cv_not_empty.wait(lock, [this]() { return this->closed || !this->items.empty(); });
+				if(this->items.empty())
+					return false;
+				item = move(this->items.front());
+				this->items.pop_front();
+				this->cv_not_full.notify_one();
+				return true;
+			}
+
+			void Close()
+			{
+				lock_guard<mutex> lock(this->mtx);
+				this->closed = true;
+				this->cv_not_empty.notify_all();
+				this->cv_not_full.notify_all();
+			}
+
+			TBoundedQueue(const usys_t capacity) : capacity(capacity), closed(false) {}
+	};
+
+	/****************************************************************************/
+
+	// fixed set of worker threads that stay alive for the lifetime of the pool
+	class TWorkerPool
+	{
+		protected:
+			TBoundedQueue<function<void()>> queue;
+			const usys_t n_threads;
+			unique_ptr<thread[]> threads;
+
+		public:
+			usys_t CountThreads() const { return this->n_threads; }
+
+			// blocks while the queue is full
+			void Submit(function<void()> task) { EL_ERROR(!this->queue.Push(move(task)), TLogicException); }
+
+			// returns false if the queue is full
+			bool TrySubmit(function<void()>& task) { return this->queue.TryPush(task); }
+
+			// waits until all submitted tasks are done - no tasks can be submitted afterwards
+			void Join();
+
+			// n_threads = 0 => one thread per CPU
+			// queue_capacity = 0 => as many queued tasks as there are threads
+			TWorkerPool(const usys_t n_threads, const usys_t queue_capacity = 0);
+			~TWorkerPool();
+	};
+
+	static usys_t DefaultThreadCount()
+	{
+		return max(1U, thread::hardware_concurrency());
+	}
+
+	void TWorkerPool::Join()
+	{
+		this->queue.Close();
+		for(usys_t i = 0; i < this->n_threads; i++)
+			if(this->threads[i].joinable())
+				this->threads[i].join();
+	}
+
+	TWorkerPool::TWorkerPool(const usys_t n_threads, const usys_t queue_capacity) :
+		queue(queue_capacity > 0 ? queue_capacity : (n_threads > 0 ? n_threads : DefaultThreadCount())),
+		n_threads(n_threads > 0 ? n_threads : DefaultThreadCount()),
+		threads(new thread[this->n_threads])
+	{
+		for(usys_t i = 0; i < this->n_threads; i++)
+			this->threads[i] = thread([this]() {
+				function<void()> task;
+				while(this->queue.Pop(task))
+				{
+					// the tasks handle their own errors - whatever escapes must not take down the process
+					try
+					{
+						task();
+					}
+					catch(const IException& e)
+					{
+						cerr<<"ERROR: worker: "<<e.Message().MakeCStr().get()<<endl;
+					}
+					catch(const exception& e)
+					{
+						cerr<<"ERROR: worker: "<<e.what()<<endl;
+					}
+				}
+			});
+	}
+
+	TWorkerPool::~TWorkerPool()
+	{
+		this->Join();
+	}
+
+	/****************************************************************************/
+
+	// pigz-style gzip stream. The input arrives in blocks, which are deflated by a pool of worker threads while
+	// the next ones are produced. Each block is primed with the last 32 KiB of the input before it (so the ratio is
+	// about the same as for a single stream) and ends on a byte boundary (Z_SYNC_FLUSH), so the compressed blocks
+	// simply concatenate into a single gzip member. The CRC of the whole input is combined from those of the blocks.
+	class TParallelGzip
+	{
+		public:
+			typedef function<void(const char* const data, const usys_t n)> emit_fn;
+
+		protected:
+			static const usys_t SZ_DICTIONARY = 32 * 1024;
+
+			struct block_t
+			{
+				unique_ptr<char[]> input;
+				usys_t n_input;
+				string dictionary;	// copy, the block before it may already be done
+				bool last;
+				string output;
+				u32_t crc;
+				exception_ptr error;
+				bool done;	// guarded by mtx
+			};
+
+			const emit_fn emit;
+			const usys_t sz_buffer;
+			const usys_t max_in_flight;
+			deque<unique_ptr<block_t>> in_flight;
+			vector<unique_ptr<char[]>> spare_buffers;
+			string tail;	// last SZ_DICTIONARY bytes of the input so far
+			u32_t crc;
+			u64_t n_input;
+			mutex mtx;
+			condition_variable cv_done;
+			TWorkerPool pool;	// declared last => its workers are joined before the blocks they work on go away
+
+			static void Compress(block_t& block);
+
+			// waits for the oldest block and emits its output
+			void Drain();
+
+		public:
+			// takes over a buffer of sz_buffer bytes holding the next n_input bytes of input and returns an empty
+			// buffer to continue with (nullptr after the last block, which also writes the gzip trailer)
+			unique_ptr<char[]> Submit(unique_ptr<char[]> input, const usys_t n_input, const bool last);
+
+			// emit: receives the compressed stream in order, always called on the thread that calls Submit()
+			// max_in_flight: number of blocks that are compressed at the same time (and of worker threads)
+			TParallelGzip(const emit_fn& emit, const usys_t sz_buffer, const usys_t max_in_flight);
+	};
+
+	void TParallelGzip::Compress(block_t& block)
+	{
+		try
+		{
+			block.crc = crc32(0, (const Bytef*)block.input.get(), block.n_input);
+
+			TRawDeflateStream deflater(Z_DEFAULT_COMPRESSION);
+			z_stream& zs = deflater.zs;
+			if(!block.dictionary.empty())
+				EL_ERROR(deflateSetDictionary(&zs, (const Bytef*)block.dictionary.data(), block.dictionary.size()) != Z_OK, TException, "unable to set the deflate dictionary");
+
+			// deflateBound() covers Z_FINISH, the flush marker of a Z_SYNC_FLUSH adds at most a few bytes more
+			block.output.resize(deflateBound(&zs, block.n_input) + 16);
+			zs.next_in = (Bytef*)block.input.get();
+			zs.avail_in = block.n_input;
+			zs.next_out = (Bytef*)&block.output[0];
+			zs.avail_out = block.output.size();
+
+			const int ret = deflate(&zs, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+			EL_ERROR(ret != (block.last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0 || zs.avail_out == 0, TException, "deflate failed");
+			block.output.resize(block.output.size() - zs.avail_out);
+		}
+		catch(...)
+		{
+			block.error = current_exception();
+		}
+	}
+
+	void TParallelGzip::Drain()
+	{
+		const unique_ptr<block_t> block = move(this->in_flight.front());
+		this->in_flight.pop_front();
+
+		{
+			unique_lock<mutex> lock(this->mtx);
+			this->cv_done.wait(lock, [&]() { return block->done; });
+		}
+
+		if(block->error)
+			rethrow_exception(block->error);
+
+		this->emit(block->output.data(), block->output.size());
+		this->crc = crc32_combine(this->crc, block->crc, block->n_input);
+		this->spare_buffers.push_back(move(block->input));
+	}
+
+	unique_ptr<char[]> TParallelGzip::Submit(unique_ptr<char[]> input, const usys_t n_input, const bool last)
+	{
+		if(this->in_flight.size() >= this->max_in_flight)
+			this->Drain();
+
+		unique_ptr<block_t> block(new block_t());
+		block->input = move(input);
+		block->n_input = n_input;
+		block->dictionary = this->tail;
+		block->last = last;
+		block->crc = 0;
+		block->done = false;
+
+		this->tail.append(block->input.get(), n_input);
+		if(this->tail.size() > SZ_DICTIONARY)
+			this->tail.erase(0, this->tail.size() - SZ_DICTIONARY);
+		this->n_input += n_input;
+
+		// the pool queues as many blocks as can be in flight, so this never blocks
+		block_t* const b = block.get();
+		this->in_flight.push_back(move(block));
+		this->pool.Submit([this, b]() {
+			Compress(*b);
+			lock_guard<mutex> lock(this->mtx);
+			b->done = true;
+			this->cv_done.notify_all();
+		});
+
+		if(last)
+		{
+			while(!this->in_flight.empty())
+				this->Drain();
+
+			// trailer: CRC32 and size of the input (modulo 2^32), little endian
+			byte_t trailer[8];
+			for(unsigned i = 0; i < 4; i++)
+			{
+				trailer[i] = (byte_t)(this->crc >> (8 * i));
+				trailer[4 + i] = (byte_t)(this->n_input >> (8 * i));
+			}
+			this->emit((const char*)trailer, sizeof(trailer));
+			return nullptr;
+		}
+
+		if(!this->spare_buffers.empty())
+		{
+			unique_ptr<char[]> buffer = move(this->spare_buffers.back());
+			this->spare_buffers.pop_back();
+			return buffer;
+		}
+		return unique_ptr<char[]>(new char[this->sz_buffer]);
+	}
+
+	TParallelGzip::TParallelGzip(const emit_fn& emit, const usys_t sz_buffer, const usys_t max_in_flight) : emit(emit), sz_buffer(sz_buffer), max_in_flight(max(max_in_flight, (usys_t)1)), crc(crc32(0, nullptr, 0)), n_input(0), pool(this->max_in_flight, this->max_in_flight)
+	{
+		// header: magic, deflate, no flags, no mtime, no extra flags, OS = unix
+		static const byte_t HEADER[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+		this->emit((const char*)HEADER, sizeof(HEADER));
+	}
+
+	/****************************************************************************/
+
+	enum class ECompression
+	{
+		NONE,
+		GZIP	// --compress gzip
+	};
+
+	// Output of ExportVTT. Collects the document in a large buffer which is written out with a single write() once
+	// it is full (and by Finish()), so a conversion needs a handful of syscalls instead of one per line.
+	// Numbers are formatted with to_chars(). In compact mode all whitespace in the JSON syntax passed to operator<<
+	// is dropped - the UVTT document has no string values which contain whitespace.
+	// With compression the full buffers are handed to a TParallelGzip instead and only its output is written.
+	class TUvttWriter
+	{
+		protected:
+			static const usys_t SZ_BUFFER = 1024 * 1024;
+
+			const int fd;	// -1 => append to target
+			string* const target;
+			const bool compact;
+			unique_ptr<char[]> buffer;
+			usys_t n_buffered;
+			u64_t n_written;
+			u64_t n_emitted;	// after compression
+			u64_t n_syscalls;
+			unique_ptr<TParallelGzip> gzip;
+
+			void Flush();
+			void Emit(const char* const data, const usys_t n);
+			TUvttWriter& Integer(const s64_t value);
+
+		public:
+			TUvttWriter& operator<<(const string_view syntax);
+			TUvttWriter& operator<<(const float value);
+
+			template<typename T, typename = enable_if_t<is_integral<T>::value>>
+			TUvttWriter& operator<<(const T value) { return this->Integer((s64_t)value); }
+
+			// returns space for n chars (n <= SZ_BUFFER), Commit() then adds the ones actually used to the output
+			char* Claim(const usys_t n);
+			void Commit(const usys_t n) { this->n_buffered += n; }
+			static usys_t MaxClaim() { return SZ_BUFFER; }
+
+			// writes out what is left in the buffer - must be called once the document is complete
+			void Finish();
+			void Report(ostream& log) const;
+
+			// n_threads: number of buffers that are compressed at the same time (see TParallelGzip)
+			TUvttWriter(const int fd, const bool compact, const ECompression compression = ECompression::NONE, const usys_t n_threads = 1);
+			TUvttWriter(string& target, const bool compact, const ECompression compression = ECompression::NONE, const usys_t n_threads = 1);
+	};
+
+	void TUvttWriter::Emit(const char* const data, const usys_t n)
+	{
+		if(this->fd < 0)
+		{
+			this->target->append(data, n);
+		}
+		else
+		{
+			for(usys_t offset = 0; offset < n;)
+			{
+				const ssize_t r = write(this->fd, data + offset, n - offset);
+				this->n_syscalls++;
+				if(r < 0 && errno == EINTR)
+					continue;
+				EL_ERROR(r <= 0, TException, TString::Format("unable to write the UVTT document: %s", strerror(errno)));
+				offset += r;
+			}
+		}
+
+		this->n_emitted += n;
+	}
+
+	void TUvttWriter::Flush()
+	{
+		if(this->gzip != nullptr)
+			this->buffer = this->gzip->Submit(move(this->buffer), this->n_buffered, false);
+		else
+			this->Emit(this->buffer.get(), this->n_buffered);
+
+		this->n_written += this->n_buffered;
+		this->n_buffered = 0;
+	}
+
+	TUvttWriter& TUvttWriter::operator<<(const string_view syntax)
+	{
+		char* const dst = this->Claim(syntax.size());
+		usys_t n = 0;
+		for(const char chr : syntax)
+			if(!this->compact || (chr != ' ' && chr != '\n'))
+				dst[n++] = chr;
+		this->Commit(n);
+		return *this;
+	}
+
+	TUvttWriter& TUvttWriter::operator<<(const float value)
+	{
+		static const usys_t SZ_MAX = 32;
+		char* const dst = this->Claim(SZ_MAX);
+		const to_chars_result result = to_chars(dst, dst + SZ_MAX, value);
+		EL_ERROR(result.ec != errc(), TLogicException);
+		this->Commit(result.ptr - dst);
+		return *this;
+	}
+
+	TUvttWriter& TUvttWriter::Integer(const s64_t value)
+	{
+		static const usys_t SZ_MAX = 24;
+		char* const dst = this->Claim(SZ_MAX);
+		const to_chars_result result = to_chars(dst, dst + SZ_MAX, value);
+		EL_ERROR(result.ec != errc(), TLogicException);
+		this->Commit(result.ptr - dst);
+		return *this;
+	}
+
+	char* TUvttWriter::Claim(const usys_t n)
+	{
+		EL_ERROR(n > SZ_BUFFER, TLogicException);
+		if(this->n_buffered + n > SZ_BUFFER)
+			this->Flush();
+		return this->buffer.get() + this->n_buffered;
+	}
+
+	void TUvttWriter::Finish()
+	{
+		if(this->gzip != nullptr)
+		{
+			this->buffer = this->gzip->Submit(move(this->buffer), this->n_buffered, true);
+			this->n_written += this->n_buffered;
+			this->n_buffered = 0;
+			this->gzip = nullptr;
+		}
+		else
+			this->Flush();
+	}
+
+	void TUvttWriter::Report(ostream& log) const
+	{
+		log<<"output: "<<this->n_written<<" bytes";
+		if(this->n_emitted != this->n_written)
+			log<<" (compressed: "<<this->n_emitted<<" bytes)";
+		if(this->fd >= 0)
+			log<<" in "<<this->n_syscalls<<" write() calls";
+		log<<endl;
+	}
+
+	TUvttWriter::TUvttWriter(const int fd, const bool compact, const ECompression compression, const usys_t n_threads) : fd(fd), target(nullptr), compact(compact), buffer(new char[SZ_BUFFER]), n_buffered(0), n_written(0), n_emitted(0), n_syscalls(0)
+	{
+		if(compression == ECompression::GZIP)
+			this->gzip = unique_ptr<TParallelGzip>(new TParallelGzip([this](const char* const data, const usys_t n) { this->Emit(data, n); }, SZ_BUFFER, n_threads));
+	}
+
+	TUvttWriter::TUvttWriter(string& target, const bool compact, const ECompression compression, const usys_t n_threads) : fd(-1), target(&target), compact(compact), buffer(new char[SZ_BUFFER]), n_buffered(0), n_written(0), n_emitted(0), n_syscalls(0)
+	{
+		if(compression == ECompression::GZIP)
+			this->gzip = unique_ptr<TParallelGzip>(new TParallelGzip([this](const char* const data, const usys_t n) { this->Emit(data, n); }, SZ_BUFFER, n_threads));
+	}
+
+	/****************************************************************************/
+
+	// ProgressRenderer is configured to render 64 pixels per cell (see README.md), which is what the UVTT
+	// document declares unless --ppg resamples the image
+	static const unsigned SOURCE_PIXELS_PER_GRID = 64;
+
+	// decoded 8 bit image, rows top to bottom without padding
+	struct image_t
+	{
+		u32_t width;
+		u32_t height;
+		u8_t n_channels;	// 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA)
+		unique_ptr<byte_t[]> pixels;
+
+		usys_t Stride() const { return (usys_t)this->width * this->n_channels; }
+	};
+
+	static const byte_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	static u32_t ReadBigEndian32(const byte_t* const p)
+	{
+		return ((u32_t)p[0] << 24) | ((u32_t)p[1] << 16) | ((u32_t)p[2] << 8) | (u32_t)p[3];
+	}
+
+	static void AppendBigEndian32(string& str, const u32_t value)
+	{
+		const char bytes[4] = { (char)(value >> 24), (char)(value >> 16), (char)(value >> 8), (char)value };
+		str.append(bytes, 4);
+	}
+
+	static void AppendPngChunk(string& png, const char type[4], const char* const data, const usys_t sz_data)
+	{
+		AppendBigEndian32(png, sz_data);
+		png.append(type, 4);
+		png.append(data, sz_data);
+		u32_t crc = crc32(0, (const Bytef*)type, 4);
+		if(sz_data > 0)	// crc32() returns its initial value for a null buffer
+			crc = crc32(crc, (const Bytef*)data, sz_data);
+		AppendBigEndian32(png, crc);
+	}
+
+	static inline byte_t PaethPredictor(const int a, const int b, const int c)
+	{
+		const int p = a + b - c;
+		const int pa = abs(p - a);
+		const int pb = abs(p - b);
+		const int pc = abs(p - c);
+		return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+	}
+
+	// Decodes a PNG file as far as --ppg and --tiles need it: 8 bit gray or RGB, with or without alpha, not interlaced
+	// (which covers what ProgressRenderer writes). Palette images, 16 bit and JPEG are rejected - only zlib is
+	// linked, there is no JPEG decoder at hand. The CRC of every chunk and the Adler-32 of the image data are checked.
+	static image_t DecodePng(const byte_t* const png, const usys_t sz_png)
+	{
+		// width * height * 4 bytes at most: a 350x350 map at SOURCE_PIXELS_PER_GRID, the filtered rows still fit
+		// into the 32 bit counters of a single inflate() call
+		static const u64_t MAX_IMAGE_BYTES = (u64_t)1 << 31;
+
+		EL_ERROR(sz_png < sizeof(PNG_SIGNATURE) || memcmp(png, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) != 0, TException, "only PNG images can be resampled or split into tiles");
+
+		image_t image = { 0, 0, 0, nullptr };
+		unique_ptr<byte_t[]> filtered;	// height * (1 filter byte + stride)
+		usys_t sz_filtered = 0;
+
+		// the IDAT chunks together form a zlib stream, its 2 byte header is skipped and the rest is raw deflate
+		TRawInflateStream inflater;
+		z_stream& zs = inflater.zs;
+		byte_t zlib_header[2];
+		usys_t n_zlib_header = 0;
+		byte_t zlib_trailer[4];	// Adler-32 of the inflated data, big endian
+		usys_t n_zlib_trailer = 0;
+		bool stream_end = false;
+
+		for(usys_t offset = sizeof(PNG_SIGNATURE);;)
+		{
+			EL_ERROR(sz_png - offset < 12, TException, "truncated PNG image");
+			const u32_t length = ReadBigEndian32(png + offset);
+			const byte_t* const type = png + offset + 4;
+			const byte_t* data = type + 4;
+			EL_ERROR(length > sz_png - offset - 12, TException, "truncated PNG image");
+			EL_ERROR(crc32(0, (const Bytef*)type, 4 + length) != ReadBigEndian32(data + length), TException, TString::Format("corrupt PNG image (CRC mismatch in chunk at offset %d)", offset));
+
+			if(memcmp(type, "IHDR", 4) == 0)
+			{
+				EL_ERROR(length < 13 || image.n_channels != 0, TException, "invalid PNG header");
+				image.width = ReadBigEndian32(data);
+				image.height = ReadBigEndian32(data + 4);
+				EL_ERROR(data[8] != 8 || data[12] != 0, TException, "only 8 bit, non-interlaced PNG images can be resampled or split into tiles");
+				switch(data[9])
+				{
+					case 0: image.n_channels = 1; break;
+					case 4: image.n_channels = 2; break;
+					case 2: image.n_channels = 3; break;
+					case 6: image.n_channels = 4; break;
+					default: EL_THROW(TException, "palette PNG images cannot be resampled or split into tiles");
+				}
+				EL_ERROR(image.width == 0 || image.height == 0 || (u64_t)image.width * image.height * 4 > MAX_IMAGE_BYTES, TException, TString::Format("unsupported PNG image size %dx%d", image.width, image.height));
+
+				sz_filtered = (usys_t)image.height * (1 + image.Stride());
+				filtered = unique_ptr<byte_t[]>(new byte_t[sz_filtered]);
+				zs.next_out = (Bytef*)filtered.get();
+				zs.avail_out = sz_filtered;
+			}
+			else if(memcmp(type, "IDAT", 4) == 0)
+			{
+				EL_ERROR(image.n_channels == 0, TException, "PNG image data before the header");
+				u32_t n_data = length;
+				while(n_zlib_header < 2 && n_data > 0)
+				{
+					zlib_header[n_zlib_header++] = *data++;
+					n_data--;
+					if(n_zlib_header == 2)
+						EL_ERROR((zlib_header[0] & 0x0f) != Z_DEFLATED || (zlib_header[1] & 0x20) != 0 || ((zlib_header[0] << 8) | zlib_header[1]) % 31 != 0, TException, "invalid PNG image data");
+				}
+
+				// Z_BUF_ERROR means the output is full but the stream goes on => more data than the header announced
+				if(!stream_end && n_data > 0)
+				{
+					zs.next_in = (Bytef*)data;
+					zs.avail_in = n_data;
+					const int ret = inflate(&zs, Z_NO_FLUSH);
+					EL_ERROR(ret != Z_OK && ret != Z_STREAM_END, TException, "invalid PNG image data");
+					stream_end = ret == Z_STREAM_END;
+					data += n_data - zs.avail_in;
+					n_data = zs.avail_in;
+				}
+
+				while(stream_end && n_zlib_trailer < 4 && n_data > 0)
+				{
+					zlib_trailer[n_zlib_trailer++] = *data++;
+					n_data--;
+				}
+			}
+			else if(memcmp(type, "IEND", 4) == 0)
+				break;
+
+			offset += 12 + (usys_t)length;
+		}
+
+		EL_ERROR(image.n_channels == 0 || zs.avail_out != 0, TException, "truncated PNG image data");
+		EL_ERROR(!stream_end || n_zlib_trailer < 4, TException, "PNG image data does not end with the image");
+		EL_ERROR(adler32_z(adler32(0, nullptr, 0), filtered.get(), sz_filtered) != ReadBigEndian32(zlib_trailer), TException, "corrupt PNG image data (Adler-32 mismatch)");
+
+		const usys_t stride = image.Stride();
+		const unsigned bpp = image.n_channels;
+		image.pixels = unique_ptr<byte_t[]>(new byte_t[(usys_t)image.height * stride]);
+		const vector<byte_t> zero_row(stride, 0);
+
+		for(u32_t y = 0; y < image.height; y++)
+		{
+			const byte_t* const src = filtered.get() + (usys_t)y * (1 + stride) + 1;
+			const byte_t* const prev = y > 0 ? image.pixels.get() + (usys_t)(y - 1) * stride : zero_row.data();
+			byte_t* const dst = image.pixels.get() + (usys_t)y * stride;
+
+			switch(src[-1])
+			{
+				case 0:
+					memcpy(dst, src, stride);
+					break;
+				case 1:
+					for(usys_t x = 0; x < stride; x++)
+						dst[x] = src[x] + (x >= bpp ? dst[x - bpp] : 0);
+					break;
+				case 2:
+					for(usys_t x = 0; x < stride; x++)
+						dst[x] = src[x] + prev[x];
+					break;
+				case 3:
+					for(usys_t x = 0; x < stride; x++)
+						dst[x] = src[x] + (byte_t)(((x >= bpp ? dst[x - bpp] : 0) + prev[x]) / 2);
+					break;
+				case 4:
+					for(usys_t x = 0; x < stride; x++)
+						dst[x] = src[x] + (x >= bpp ? PaethPredictor(dst[x - bpp], prev[x], prev[x - bpp]) : prev[x]);
+					break;
+				default:
+					EL_THROW(TException, "invalid PNG filter type");
+			}
+		}
+
+		return image;
+	}
+
+	// Encodes the image as PNG. The rows are split into n_threads bands, each band is Paeth-filtered and deflated
+	// on its own thread. The bands end with a sync flush, so (like in TParallelGzip) their output simply
+	// concatenates into one zlib stream, the Adler-32 of the whole stream is combined from those of the bands.
+	static string EncodePng(const image_t& image, const usys_t n_threads)
+	{
+		const usys_t stride = image.Stride();
+		const unsigned bpp = image.n_channels;
+		const usys_t n_bands = max((usys_t)1, min(n_threads, (usys_t)image.height));
+
+		struct band_t
+		{
+			unique_ptr<byte_t[]> filtered;
+			usys_t sz_filtered;
+			string output;
+			u32_t adler;
+			exception_ptr error;
+		};
+		vector<band_t> bands(n_bands);
+
+		RunBands(n_bands, [&](const usys_t idx_band) {
+			band_t& band = bands[idx_band];
+			try
+			{
+				const usys_t y_begin = BandBegin(image.height, n_bands, idx_band);
+				const usys_t y_end = BandBegin(image.height, n_bands, idx_band + 1);
+
+				band.sz_filtered = (y_end - y_begin) * (1 + stride);
+				band.filtered = unique_ptr<byte_t[]>(new byte_t[band.sz_filtered]);
+				for(usys_t y = y_begin; y < y_end; y++)
+				{
+					const byte_t* const src = image.pixels.get() + y * stride;
+					const byte_t* const prev = y > 0 ? src - stride : nullptr;
+					byte_t* const dst = band.filtered.get() + (y - y_begin) * (1 + stride) + 1;
+
+					if(prev == nullptr)
+					{
+						dst[-1] = 1;	// sub
+						for(usys_t x = 0; x < stride; x++)
+							dst[x] = src[x] - (x >= bpp ? src[x - bpp] : 0);
+					}
+					else
+					{
+						dst[-1] = 4;	// paeth
+						for(usys_t x = 0; x < stride; x++)
+							dst[x] = src[x] - (x >= bpp ? PaethPredictor(src[x - bpp], prev[x], prev[x - bpp]) : prev[x]);
+					}
+				}
+
+				band.adler = adler32(adler32(0, nullptr, 0), (const Bytef*)band.filtered.get(), band.sz_filtered);
+
+				const bool last = idx_band + 1 == n_bands;
+				TRawDeflateStream deflater(Z_DEFAULT_COMPRESSION);
+				z_stream& zs = deflater.zs;
+				band.output.resize(deflateBound(&zs, band.sz_filtered) + 16);
+				zs.next_in = (Bytef*)band.filtered.get();
+				zs.avail_in = band.sz_filtered;
+				zs.next_out = (Bytef*)&band.output[0];
+				zs.avail_out = band.output.size();
+
+				const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+				EL_ERROR(ret != (last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0 || zs.avail_out == 0, TException, "deflate failed");
+				band.output.resize(band.output.size() - zs.avail_out);
+				band.filtered = nullptr;
+			}
+			catch(...)
+			{
+				band.error = current_exception();
+			}
+		});
+
+		string png((const char*)PNG_SIGNATURE, sizeof(PNG_SIGNATURE));
+
+		static const char COLOR_TYPES[5] = { 0, 0, 4, 2, 6 };	// by number of channels
+		string header;
+		AppendBigEndian32(header, image.width);
+		AppendBigEndian32(header, image.height);
+		const char header_tail[5] = { 8, COLOR_TYPES[image.n_channels], 0, 0, 0 };	// bit depth, color type, compression, filter, interlace
+		header.append(header_tail, sizeof(header_tail));
+		AppendPngChunk(png, "IHDR", header.data(), header.size());
+
+		// one IDAT chunk per band, the first one starts with the zlib header, the last one ends with the checksum
+		u32_t adler = adler32(0, nullptr, 0);
+		for(usys_t i = 0; i < n_bands; i++)
+		{
+			if(bands[i].error)
+				rethrow_exception(bands[i].error);
+
+			adler = adler32_combine(adler, bands[i].adler, bands[i].sz_filtered);
+			if(i == 0)
+				bands[i].output.insert(0, "\x78\x9c", 2);
+			if(i + 1 == n_bands)
+				AppendBigEndian32(bands[i].output, adler);
+			AppendPngChunk(png, "IDAT", bands[i].output.data(), bands[i].output.size());
+		}
+
+		AppendPngChunk(png, "IEND", nullptr, 0);
+		return png;
+	}
+
+	// area-averaging weights for scaling n_src pixels to n_dst pixels along one axis: target pixel i is the
+	// weighted sum of the source pixels first[i] to first[i] + n[i] - 1, which it overlaps by weights[offset[i] + k]
+	struct resample_taps_t
+	{
+		vector<u32_t> first;
+		vector<u32_t> n;
+		vector<u32_t> offset;
+		vector<float> weights;
+
+		resample_taps_t(const u32_t n_src, const u32_t n_dst) : first(n_dst), n(n_dst), offset(n_dst)
+		{
+			const double scale = (double)n_src / n_dst;	// source pixels per target pixel
+			for(u32_t i = 0; i < n_dst; i++)
+			{
+				const double lo = i * scale;
+				const double hi = min((i + 1) * scale, (double)n_src);
+				const u32_t j_begin = min((u32_t)lo, n_src - 1);
+				const u32_t j_end = max(j_begin + 1, min((u32_t)ceil(hi), n_src));
+
+				this->first[i] = j_begin;
+				this->n[i] = j_end - j_begin;
+				this->offset[i] = this->weights.size();
+
+				double sum = 0.0;
+				for(u32_t j = j_begin; j < j_end; j++)
+					sum += max(0.0, min(hi, (double)j + 1) - max(lo, (double)j));
+				for(u32_t j = j_begin; j < j_end; j++)
+					this->weights.push_back(sum > 0.0 ? (float)(max(0.0, min(hi, (double)j + 1) - max(lo, (double)j)) / sum) : 1.0f / (j_end - j_begin));
+			}
+		}
+	};
+
+	// Scales the image to width x height with a box (area-averaging) filter. The target rows are split into
+	// n_threads bands. For every target row the contributing source rows are first summed up into a row of floats
+	// (straight loops over whole rows, which the compiler vectorizes), that row is then reduced horizontally.
+	// The colors of images with alpha are weighted by it (premultiplied) while they are summed up and divided by
+	// the summed up alpha at the end, so fully transparent pixels do not bleed their (arbitrary) color into the
+	// pixels next to them.
+	static image_t ResampleImage(const image_t& src, const u32_t width, const u32_t height, const usys_t n_threads)
+	{
+		image_t dst = { width, height, src.n_channels, nullptr };
+		dst.pixels = unique_ptr<byte_t[]>(new byte_t[(usys_t)height * dst.Stride()]);
+
+		const resample_taps_t taps_x(src.width, width);
+		const resample_taps_t taps_y(src.height, height);
+		const usys_t src_stride = src.Stride();
+		const usys_t dst_stride = dst.Stride();
+		const unsigned nc = src.n_channels;
+		const bool has_alpha = nc == 2 || nc == 4;	// always the last channel
+		const usys_t n_bands = max((usys_t)1, min(n_threads, (usys_t)height));
+
+		RunBands(n_bands, [&](const usys_t idx_band) {
+			unique_ptr<float[]> row(new float[src_stride]);
+			const usys_t y_end = BandBegin(height, n_bands, idx_band + 1);
+			for(usys_t y = BandBegin(height, n_bands, idx_band); y < y_end; y++)
+			{
+				float* const acc = row.get();
+				fill(acc, acc + src_stride, 0.0f);
+				for(u32_t k = 0; k < taps_y.n[y]; k++)
+				{
+					const byte_t* const src_row = src.pixels.get() + (usys_t)(taps_y.first[y] + k) * src_stride;
+					const float w = taps_y.weights[taps_y.offset[y] + k];
+					if(has_alpha)
+					{
+						for(usys_t x = 0; x < src_stride; x += nc)
 						{
-							n_windows++;
-							this->obstacle_map.PlaceObstacleAt(pos, EObstacleType::WINDOW);
+							const float alpha = w * (float)src_row[x + nc - 1];
+							for(unsigned c = 0; c + 1 < nc; c++)
+								acc[x + c] += alpha * (float)src_row[x + c] * (1.0f / 255.0f);
+							acc[x + nc - 1] += alpha;
 						}
-						else if(strcmp(def_node->GetText(), "TorchLamp") == 0)
+					}
+					else
+					{
+						for(usys_t x = 0; x < src_stride; x++)
+							acc[x] += w * (float)src_row[x];
+					}
+				}
+
+				byte_t* const dst_row = dst.pixels.get() + y * dst_stride;
+				for(u32_t x = 0; x < width; x++)
+				{
+					float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+					const float* const p = acc + (usys_t)taps_x.first[x] * nc;
+					const float* const w = &taps_x.weights[taps_x.offset[x]];
+					for(u32_t k = 0; k < taps_x.n[x]; k++)
+						for(unsigned c = 0; c < nc; c++)
+							sum[c] += w[k] * p[k * nc + c];
+					if(has_alpha)
+					{
+						const float alpha = sum[nc - 1];
+						for(unsigned c = 0; c + 1 < nc; c++)
+							sum[c] = alpha > 0.0f ? sum[c] * 255.0f / alpha : 0.0f;
+					}
+					for(unsigned c = 0; c < nc; c++)
+						dst_row[(usys_t)x * nc + c] = (byte_t)min(255.0f, sum[c] + 0.5f);
+				}
+			}
+		});
+
+		return dst;
+	}
+
+	// copies the width x height pixels at x/y (from the top left corner) into an image of their own
+	static image_t CropImage(const image_t& src, const u32_t x, const u32_t y, const u32_t width, const u32_t height)
+	{
+		image_t dst = { width, height, src.n_channels, nullptr };
+		dst.pixels = unique_ptr<byte_t[]>(new byte_t[(usys_t)height * dst.Stride()]);
+		for(u32_t row = 0; row < height; row++)
+			memcpy(dst.pixels.get() + (usys_t)row * dst.Stride(), src.pixels.get() + (usys_t)(y + row) * src.Stride() + (usys_t)x * src.n_channels, dst.Stride());
+		return dst;
+	}
+
+	// --ppg: decodes the image, scales it from SOURCE_PIXELS_PER_GRID to pixels_per_grid pixels per cell and
+	// returns it encoded as PNG again - resampling and encoding use n_threads threads
+	static string ResampleImageFile(const byte_t* const image, const usys_t sz_image, const unsigned pixels_per_grid, const usys_t n_threads, ostream& log)
+	{
+		const auto ts_start = chrono::steady_clock::now();
+		const image_t src = DecodePng(image, sz_image);
+		const u32_t width = max((u64_t)1, ((u64_t)src.width * pixels_per_grid + SOURCE_PIXELS_PER_GRID / 2) / SOURCE_PIXELS_PER_GRID);
+		const u32_t height = max((u64_t)1, ((u64_t)src.height * pixels_per_grid + SOURCE_PIXELS_PER_GRID / 2) / SOURCE_PIXELS_PER_GRID);
+		const string png = EncodePng(ResampleImage(src, width, height, n_threads), n_threads);
+		const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - ts_start).count();
+
+		// a single write, the single map mode calls this on a background thread
+		ostringstream ss;
+		ss<<"image: "<<src.width<<"x"<<src.height<<" -> "<<width<<"x"<<height<<" pixels, "<<sz_image<<" -> "<<png.size()<<" bytes in "<<ms<<" ms"<<endl;
+		log<<ss.str()<<flush;
+		return png;
+	}
+
+	/****************************************************************************/
+
+	// Maps and base64-encodes an image file on a background thread. The image does not depend on the savegame, so
+	// the single map mode starts encoding right away and the encoding overlaps the parsing and the graph computation.
+	// With --ppg the image is resampled there as well.
+	// The encoded image is handed over in fixed size chunks through a bounded queue, so at most MAX_CHUNKS_AHEAD
+	// chunks are held in memory, whatever the size of the image. Whatever does not fit in there is encoded while
+	// WriteTo() drains the queue.
+	class TImageEncoder
+	{
+		protected:
+			static const usys_t SZ_CHUNK = 48 * 1024;	// of the input, must be a multiple of 3 => no padding between chunks
+			static const usys_t MAX_CHUNKS_AHEAD = 256;	// 16 MiB of encoded image
+
+			TFile* const file;
+			const unsigned pixels_per_grid;
+			const usys_t n_threads;
+			ostream& log;
+			TBoundedQueue<string> chunks;	// closed by the worker once the image is done (or failed)
+			exception_ptr error;
+			thread worker;
+
+			// returns false if the queue was closed by the destructor
+			bool EncodeChunks(const byte_t* const image, const usys_t sz_image);
+
+			void Encode();
+
+		public:
+			// writes the encoded image (without quotes) to out as the chunks become available
+			// rethrows the error if reading or encoding the image failed
+			void WriteTo(TUvttWriter& out);
+
+			// file must stay open until WriteTo() returns or the encoder is destroyed
+			// pixels_per_grid: resample the image to this many pixels per cell (see ResampleImageFile()), 0 = embed it as is
+			TImageEncoder(TFile* const file, const unsigned pixels_per_grid = 0, const usys_t n_threads = 1, ostream& log = cerr);
+			~TImageEncoder();
+	};
+
+	bool TImageEncoder::EncodeChunks(const byte_t* const image, const usys_t sz_image)
+	{
+		for(usys_t offset = 0; offset < sz_image; offset += SZ_CHUNK)
+		{
+			const usys_t n_chunk = min(sz_image - offset, SZ_CHUNK);
+			string chunk(TBase64Encoder::EncodedSize(n_chunk), 0);
+			chunk.resize(TBase64Encoder::Encode(image + offset, n_chunk, &chunk[0]));
+			if(!this->chunks.Push(move(chunk)))
+				return false;
+		}
+		return true;
+	}
+
+	void TImageEncoder::Encode()
+	{
+		try
+		{
+			TMapping mapping(this->file);
+			if(this->pixels_per_grid > 0)
+			{
+				const string png = ResampleImageFile(mapping.Count() > 0 ? &mapping[0] : nullptr, mapping.Count(), this->pixels_per_grid, this->n_threads, this->log);
+				this->EncodeChunks((const byte_t*)png.data(), png.size());
+			}
+			else if(mapping.Count() > 0)
+				this->EncodeChunks(&mapping[0], mapping.Count());
+		}
+		catch(...)
+		{
+			this->error = current_exception();
+		}
+		this->chunks.Close();
+	}
+
+	void TImageEncoder::WriteTo(TUvttWriter& out)
+	{
+		string chunk;
+		while(this->chunks.Pop(chunk))
+		{
+			for(usys_t offset = 0; offset < chunk.size();)
+			{
+				const usys_t n = min(chunk.size() - offset, TUvttWriter::MaxClaim());
+				memcpy(out.Claim(n), chunk.data() + offset, n);
+				out.Commit(n);
+				offset += n;
+			}
+		}
+
+		// the queue is only closed once the worker is done
+		if(this->worker.joinable())
+			this->worker.join();
+
+		if(this->error)
+			rethrow_exception(this->error);
+	}
+
+	TImageEncoder::TImageEncoder(TFile* const file, const unsigned pixels_per_grid, const usys_t n_threads, ostream& log) : file(file), pixels_per_grid(pixels_per_grid), n_threads(n_threads), log(log), chunks(MAX_CHUNKS_AHEAD)
+	{
+		this->worker = thread(&TImageEncoder::Encode, this);
+	}
+
+	TImageEncoder::~TImageEncoder()
+	{
+		// unblocks the worker if WriteTo() was never called (the conversion failed before)
+		this->chunks.Close();
+		if(this->worker.joinable())
+			this->worker.join();
+	}
+
+	/****************************************************************************/
+
+	struct cache_header_t
+	{
+		static constexpr char MAGIC[4] = { 'R', '2', 'V', 'C' };
+		static const u32_t VERSION = 3;
+
+		char magic[4];
+		u32_t version;
+		s16_t size[2];
+		s16_t image_pos[2];
+		s16_t image_size[2];
+		u32_t n_obstacles;
+		u32_t n_lights;
+	};
+
+	struct cache_obstacle_t
+	{
+		s16_t pos[2][2];
+		EObstacleType type;
+	} __attribute__((packed));
+
+	struct cache_light_t
+	{
+		s16_t pos[2];
+		float range;
+		u32_t color;
+	};
+
+	// the packed obstacles end at any byte => the lights start at the next multiple of alignof(cache_light_t)
+	static usys_t CacheLightsOffset(const u32_t n_obstacles)
+	{
+		const usys_t offset = sizeof(cache_header_t) + n_obstacles * sizeof(cache_obstacle_t);
+		return (offset + alignof(cache_light_t) - 1) / alignof(cache_light_t) * alignof(cache_light_t);
+	}
+
+	// Binary intermediate format of a parsed map (--dump-map / --load-map). Holds the state TMap has
+	// right before ComputeObstacleGraph, so exports can be rerun without touching the savegame.
+	// Like the obstacle map it only holds the window of the image area and its margin (see TMap::CULL_MARGIN).
+	// The file is mapped and read directly from the mapping, the loader places the obstacles into a new obstacle map.
+	// All values are in the native byte order of the machine which wrote the file (all sections 8 byte aligned),
+	// byte_order tells the loader to reject files from a machine with a different one:
+	//
+	//   map_dump_header_t
+	//   n_planes bit planes, one per EObstacleType starting at WALL: window_size[0] * window_size[1] bits in
+	//     row-major order (bit i of word j covers tile j * 64 + i of the window), each plane padded to whole u64_t words
+	//   n_lights * cache_light_t
+	struct map_dump_header_t
+	{
+		static constexpr char MAGIC[4] = { 'R', '2', 'V', 'M' };
+		static const u32_t VERSION = 4;
+		static const u32_t BYTE_ORDER_MARK = 0x01020304;	// as written in native byte order
+
+		char magic[4];
+		u32_t version;
+		s16_t size[2];
+		s16_t image_pos[2];
+		s16_t image_size[2];
+		s16_t window_pos[2];	// the rectangle of the map covered by the planes
+		s16_t window_size[2];
+		u32_t n_planes;
+		u32_t n_lights;
+		u32_t byte_order;	// BYTE_ORDER_MARK
+
+		static usys_t WordsPerPlane(const s16_t size[2]) { return ((usys_t)size[0] * (usys_t)size[1] + 63) / 64; }
+	};
+
+	enum class EGraphEngine : u8_t
+	{
+		WALKER,	// segments along the center of the walls, see TObstacleMap::ComputeObstacleGraph()
+		CONTOUR	// segments along the outlines of the obstacles, see TObstacleMap::ComputeContourGraph()
+	};
+
+	// how the obstacle graph is computed
+	struct graph_options_t
+	{
+		EGraphEngine engine;	// --engine walker|contour
+		float simplify_tolerance;	// CONTOUR only (--simplify TILES), 0 = off
+		usys_t n_threads;	// WALKER only, see TObstacleMap::ComputeObstacleGraph()
+
+		// identifies the options which change the graph - 0 for the defaults (see TConversionCache::Key())
+		u64_t Fingerprint() const
+		{
+			if(this->engine == EGraphEngine::WALKER)
+				return 0;
+			u32_t tolerance_bits;
+			memcpy(&tolerance_bits, &this->simplify_tolerance, sizeof(tolerance_bits));
+			return ((u64_t)this->engine << 32) | tolerance_bits;
+		}
+
+		graph_options_t() : engine(EGraphEngine::WALKER), simplify_tolerance(0.0f), n_threads(1) {}
+	};
+
+	// how a map is converted and written out - shared by all modes
+	struct export_options_t
+	{
+		graph_options_t graph;
+		bool merge_segments;	// merge collinear, touching walls (--no-merge turns it off)
+		bool polylines;	// join the walls into polylines (--polylines)
+		bool compact;	// write the UVTT document without any whitespace (--compact)
+		ECompression compression;	// --compress
+		unsigned pixels_per_grid;	// resample the image to this many pixels per cell (--ppg), 0 = embed it as is
+
+		// file name extension of the UVTT documents
+		const char* Extension() const { return this->compression == ECompression::GZIP ? ".uvtt.gz" : ".uvtt"; }
+
+		export_options_t() : merge_segments(true), polylines(false), compact(false), compression(ECompression::NONE), pixels_per_grid(0) {}
+	};
+
+	// One of the --tiles parts of the image area, exported as a scene of its own. Holds the segments and wall
+	// polylines of the shared graph clipped to its rectangle.
+	struct scene_tile_t
+	{
+		unsigned col;	// counted from the left
+		unsigned row;	// counted from the top, like the rows of the image
+		v2i_t pos;	// map coordinates, like TMap::image_pos
+		v2i_t size;
+		TList<obstacle_t> segments;
+		vector<vector<v2f_t>> wall_polylines;
+	};
+
+	struct TMap
+	{
+		unique_ptr<TObstacleMap> obstacle_map;
+		TList<light_source_t> lights;
+		const v2i_t size;
+		v2i_t image_pos;
+		v2i_t image_size;
+		vector<vector<v2f_t>> wall_polylines;
+		bool export_polylines = false;	// write wall_polylines instead of the WALL segments of the graph
+		unsigned pixels_per_grid = SOURCE_PIXELS_PER_GRID;	// as declared in the document (see export_options_t::pixels_per_grid)
+
+		// Only the tiles of the image area and CULL_MARGIN tiles around it are placed into the obstacle map, the rest
+		// of the map never makes it into the graph. The margin gives the tiles at the edge of the image area all the
+		// neighbors they have on the map, so within the image area the graph is the same as for the whole map.
+		// Simplified contours are no exception, as they are clipped to the image area before they are simplified.
+		// Define RIM2VTT_CHECK_CULLING to compare every graph against the one of the whole map.
+		static const s16_t CULL_MARGIN = 1;
+		bool culled = true;	// false => the obstacle map covers the whole map
+		void CullWindow(v2i_t& pos, v2i_t& size) const;	// the rectangle of the map that goes into the obstacle map
+		unique_ptr<TObstacleMap> CreateObstacleMap() const;
+
+		// the outer edges of the tiles at the border of the image area
+		void ImageArea(v2f_t& lo, v2f_t& hi) const;
+
+		// clips the graph to the image area, merges it and builds the polylines as requested by options, logs the segment counts
+		// also takes over the pixels per cell to declare
+		void PrepareExport(const export_options_t& options, ostream& log);
+		void BuildWallPolylines();
+
+		// writes everything but the image and the closing brace of the document
+		void ExportGeometry(TUvttWriter& out);
+
+		// the same for the rectangle area_pos/area_size of the image area, which obstacles and polylines must be clipped to
+		template<typename TSegments>
+		void ExportGeometry(TUvttWriter& out, const v2i_t area_pos, const v2i_t area_size, const TSegments& obstacles, const vector<vector<v2f_t>>& polylines);
+
+		// cuts tile (col, row) out of the image area split into n_cols x n_rows (about) equal parts
+		// only reads the map, so the tiles can be cut and exported on several threads at once
+		void CutTile(scene_tile_t& tile, const unsigned col, const unsigned row, const unsigned n_cols, const unsigned n_rows) const;
+
+		// image: the raw image file (PNG, JPEG, ...) to embed or nullptr
+		// the caller calls out.Finish() afterwards
+		void ExportVTT(TUvttWriter& out, const byte_t* const image, const usys_t sz_image);
+		void ExportVTT(TUvttWriter& out, TFile* const image);
+		void ExportVTT(TUvttWriter& out, TImageEncoder* const image);
+		void ExportVTT(TUvttWriter& out, const scene_tile_t& tile, const byte_t* const image, const usys_t sz_image);
+		void WriteCache(ostream& os) const;
+		void WriteDump(ostream& os) const;
+
+		// places an obstacle on every tile the thing covers (see TDefRegistry::def_t::footprint)
+		void PlaceFootprint(const thing_t& thing, const TDefRegistry::def_t& def, const EObstacleType type);
+
+		void ComputeGraph(const graph_options_t& graph_options, ostream& log);
+
+		// culled = false places the whole map into the obstacle map (see RIM2VTT_CHECK_CULLING)
+		TMap(const savegame_map_t& savegame_map, ostream& log = cerr, const graph_options_t& graph_options = graph_options_t(), const bool culled = true);
+		TMap(const cache_header_t& header, const cache_obstacle_t* const obstacles, const cache_light_t* const lights);
+
+		// load from a --dump-map file (which must stay mapped while the constructor runs)
+		TMap(const byte_t* const dump, const usys_t sz_dump, ostream& log = cerr, const graph_options_t& graph_options = graph_options_t());
+	};
+
+	void TMap::CullWindow(v2i_t& pos, v2i_t& size) const
+	{
+		if(!this->culled)
+		{
+			pos = {0,0};
+			size = this->size;
+			return;
+		}
+
+		const v2i_t first = {
+			(s16_t)max(0, this->image_pos[0] - CULL_MARGIN),
+			(s16_t)max(0, this->image_pos[1] - CULL_MARGIN)
+		};
+		const v2i_t end = {
+			(s16_t)max((int)first[0], min((int)this->size[0], this->image_pos[0] + this->image_size[0] + CULL_MARGIN)),
+			(s16_t)max((int)first[1], min((int)this->size[1], this->image_pos[1] + this->image_size[1] + CULL_MARGIN))
+		};
+		pos = first;
+		size = end - first;
+	}
+
+	unique_ptr<TObstacleMap> TMap::CreateObstacleMap() const
+	{
+		v2i_t pos, size;
+		this->CullWindow(pos, size);
+		return unique_ptr<TObstacleMap>(new TObstacleMap(pos, size));
+	}
+
+	void TMap::ImageArea(v2f_t& lo, v2f_t& hi) const
+	{
+		lo = (v2f_t)this->image_pos - v2f_t({0.5f,0.5f});
+		hi = (v2f_t)(this->image_pos + this->image_size) - v2f_t({0.5f,0.5f});
+	}
+
+	void TMap::PrepareExport(const export_options_t& options, ostream& log)
+	{
+		this->pixels_per_grid = options.pixels_per_grid > 0 ? options.pixels_per_grid : SOURCE_PIXELS_PER_GRID;
+
+		v2f_t lo, hi;
+		this->ImageArea(lo, hi);
+
+		const usys_t n_segments = this->obstacle_map->Graph().Count();
+		this->obstacle_map->ClipSegments(lo, hi);
+		log<<"segments: "<<n_segments<<" (within the image area: "<<this->obstacle_map->Graph().Count();
+		if(options.merge_segments)
+		{
+			this->obstacle_map->MergeCollinearSegments();
+			log<<", after merging: "<<this->obstacle_map->Graph().Count();
+		}
+		log<<")"<<endl;
+
+		if(options.polylines)
+		{
+			this->BuildWallPolylines();
+			this->export_polylines = true;
+			log<<"wall polylines: "<<this->wall_polylines.size()<<endl;
+		}
+	}
+
+	void TMap::CutTile(scene_tile_t& tile, const unsigned col, const unsigned row, const unsigned n_cols, const unsigned n_rows) const
+	{
+		const usys_t x_begin = BandBegin(this->image_size[0], n_cols, col);
+		const usys_t x_end = BandBegin(this->image_size[0], n_cols, col + 1);
+
+		// rows are counted from the top, the map y axis points up
+		const usys_t y_begin = BandBegin(this->image_size[1], n_rows, row);
+		const usys_t y_end = BandBegin(this->image_size[1], n_rows, row + 1);
+
+		tile.col = col;
+		tile.row = row;
+		tile.pos = { (s16_t)(this->image_pos[0] + x_begin), (s16_t)(this->image_pos[1] + this->image_size[1] - y_end) };
+		tile.size = { (s16_t)(x_end - x_begin), (s16_t)(y_end - y_begin) };
+
+		// the outer edges of the tiles at the border of the scene tile, like in PrepareExport()
+		const v2f_t lo = (v2f_t)tile.pos - v2f_t({0.5f,0.5f});
+		const v2f_t hi = (v2f_t)(tile.pos + tile.size) - v2f_t({0.5f,0.5f});
+
+		ClipToRectangle(this->obstacle_map->Graph(), lo, hi, tile.segments);
+
+		tile.wall_polylines.clear();
+		if(this->export_polylines)
+			for(const vector<v2f_t>& polyline : this->wall_polylines)
+				ClipPolyline(polyline, lo, hi, tile.wall_polylines);
+	}
+
+	void TMap::BuildWallPolylines()
+	{
+		const TList<const obstacle_t>& obstacles = this->obstacle_map->Graph();
+		static const u32_t NONE = (u32_t)-1;
+
+		// endpoints are compared bit by bit - a point shared by two walls is the same float in both
+		auto key = [](const v2f_t pos) {
+			u32_t bits[2];
+			memcpy(&bits[0], &pos[0], sizeof(bits[0]));
+			memcpy(&bits[1], &pos[1], sizeof(bits[1]));
+			return ((u64_t)bits[0] << 32) | bits[1];
+		};
+
+		vector<u32_t> walls;
+		for(usys_t i = 0; i < obstacles.Count(); i++)
+			if(obstacles[i].type == EObstacleType::WALL && key(obstacles[i].pos[0]) != key(obstacles[i].pos[1]))
+				walls.push_back(i);
+
+		// a polyline continues through a point only if exactly two walls meet there
+		struct end_t { u64_t key; u32_t idx_wall; u32_t side; };
+		vector<end_t> ends;
+		ends.reserve(walls.size() * 2);
+		for(u32_t idx_wall = 0; idx_wall < walls.size(); idx_wall++)
+			for(u32_t side = 0; side < 2; side++)
+				ends.push_back(end_t({ key(obstacles[walls[idx_wall]].pos[side]), idx_wall, side }));
+		sort(ends.begin(), ends.end(), [](const end_t& a, const end_t& b) { return a.key != b.key ? a.key < b.key : a.idx_wall < b.idx_wall; });
+
+		vector<u32_t> next(walls.size() * 2, NONE);	// [idx_wall * 2 + side] => the wall continuing there
+		for(usys_t i = 0; i < ends.size();)
+		{
+			usys_t j = i + 1;
+			while(j < ends.size() && ends[j].key == ends[i].key)
+				j++;
+			if(j - i == 2)
+			{
+				next[ends[i].idx_wall * 2 + ends[i].side] = ends[i + 1].idx_wall;
+				next[ends[i + 1].idx_wall * 2 + ends[i + 1].side] = ends[i].idx_wall;
+			}
+			i = j;
+		}
+
+		this->wall_polylines.clear();
+		vector<bool> used(walls.size(), false);
+
+		// open chains first (starting at a loose end or a junction), then whatever is left are closed loops
+		for(unsigned pass = 0; pass < 2; pass++)
+		{
+			for(u32_t idx_start = 0; idx_start < walls.size(); idx_start++)
+			{
+				if(used[idx_start])
+					continue;
+
+				u32_t side_in = next[idx_start * 2] == NONE ? 0 : 1;
+				if(pass == 0 && next[idx_start * 2 + side_in] != NONE)
+					continue;
+
+				vector<v2f_t> polyline = { obstacles[walls[idx_start]].pos[side_in] };
+				for(u32_t idx_wall = idx_start;;)
+				{
+					used[idx_wall] = true;
+					const u32_t side_out = 1 - side_in;
+					const v2f_t pos_out = obstacles[walls[idx_wall]].pos[side_out];
+					polyline.push_back(pos_out);
+
+					const u32_t idx_next = next[idx_wall * 2 + side_out];
+					if(idx_next == NONE || used[idx_next])
+						break;
+
+					side_in = key(obstacles[walls[idx_next]].pos[0]) == key(pos_out) ? 0 : 1;
+					idx_wall = idx_next;
+				}
+
+				this->wall_polylines.push_back(move(polyline));
+			}
+		}
+	}
+
+	void TMap::ComputeGraph(const graph_options_t& graph_options, ostream& log)
+	{
+		switch(graph_options.engine)
+		{
+			case EGraphEngine::WALKER:
+				this->obstacle_map->ComputeObstacleGraph(graph_options.n_threads);
+				break;
+
+			case EGraphEngine::CONTOUR:
+			{
+				v2f_t lo, hi;
+				this->ImageArea(lo, hi);
+				this->obstacle_map->ComputeContourGraph(graph_options.simplify_tolerance, lo, hi);
+				break;
+			}
+		}
+
+		log<<"obstacles: "<<this->obstacle_map->Graph().Count()<<endl;
+	}
+
+	void TMap::PlaceFootprint(const thing_t& thing, const TDefRegistry::def_t& def, const EObstacleType type)
+	{
+		if(def.footprint[0] == 1 && def.footprint[1] == 1)
+		{
+			if(this->obstacle_map->IsValidPosition(thing.pos))
+				this->obstacle_map->PlaceObstacleAt(thing.pos, type);
+			return;
+		}
+
+		// same as Rimworld's GenAdj.OccupiedRect(): the position is the center, rounded depending on the rotation
+		v2i_t size = { def.footprint[0], def.footprint[1] };
+		v2i_t center = thing.pos;
+		if(thing.rot == 1 || thing.rot == 3)
+			size = { size[1], size[0] };
+		if((thing.rot == 2 || thing.rot == 3) && size[0] % 2 == 0)
+			center[0]--;
+		if((thing.rot == 1 || thing.rot == 2) && size[1] % 2 == 0)
+			center[1]--;
+
+		// tiles which are already taken (e.g. by rock from the thing map) keep their obstacle, culled tiles stay empty
+		const v2i_t first = { (s16_t)(center[0] - (size[0] - 1) / 2), (s16_t)(center[1] - (size[1] - 1) / 2) };
+		for(s16_t y = first[1]; y < first[1] + size[1]; y++)
+			for(s16_t x = first[0]; x < first[0] + size[0]; x++)
+				if(this->obstacle_map->IsValidPosition({x,y}) && this->obstacle_map->TypeAt({x,y}) == EObstacleType::NONE)
+					this->obstacle_map->PlaceObstacleAt({x,y}, type);
+	}
+
+#ifdef RIM2VTT_CHECK_CULLING
+	// true if both maps have the same segments within the image area (in any order) - a segment traced from its other end
+	// in one of them still counts as the same
+	static bool SameGraphInImageArea(const TMap& a, const TMap& b)
+	{
+		auto clipped_segments = [](const TMap& map) {
+			v2f_t lo, hi;
+			map.ImageArea(lo, hi);
+			TList<obstacle_t> segments;
+			ClipToRectangle(map.obstacle_map->Graph(), lo, hi, segments);
+
+			vector<array<float, 5>> sorted;
+			for(usys_t i = 0; i < segments.Count(); i++)
+			{
+				const obstacle_t& s = segments[i];
+				const bool swapped = s.pos[1][0] < s.pos[0][0] || (s.pos[1][0] == s.pos[0][0] && s.pos[1][1] < s.pos[0][1]);
+				const v2f_t& from = s.pos[swapped ? 1 : 0];
+				const v2f_t& to = s.pos[swapped ? 0 : 1];
+				sorted.push_back({ (float)s.type, from[0], from[1], to[0], to[1] });
+			}
+			sort(sorted.begin(), sorted.end());
+			return sorted;
+		};
+
+		return clipped_segments(a) == clipped_segments(b);
+	}
+#endif
+
+	TMap::TMap(const savegame_map_t& savegame_map, ostream& log, const graph_options_t& graph_options, const bool culled) : size(savegame_map.size), culled(culled)
+	{
+		log<<endl<<"map ID: "<<savegame_map.id<<endl;
+		log<<"size: ["<<this->size[0]<<"; "<<this->size[1]<<"]"<<endl;
+
+		EL_ERROR(this->size[0] <= 0 || this->size[1] <= 0, TException, "no valid <mapInfo><size> node found");
+
+		this->image_pos = {0,0};
+		this->image_size = this->size;
+
+		if(savegame_map.has_image_area)
+		{
+			this->image_pos = savegame_map.image_pos;
+			this->image_size = savegame_map.image_end - this->image_pos;
+		}
+
+		log<<"image area: pos = {"<<this->image_pos[0]<<"; "<<this->image_pos[1]<<"}, size = {"<<this->image_size[0]<<"; "<<this->image_size[1]<<"}"<<endl;
+
+		EL_ERROR(this->image_size[0] > this->size[0] || this->image_size[1] > this->size[1], TException, "image size is bigger than map size");
+		this->obstacle_map = this->CreateObstacleMap();
+
+		unsigned n_walls = 0;
+		unsigned n_windows = 0;
+		unsigned n_doors = 0;
+		unsigned n_terrain = 0;
+		unsigned n_lights = 0;
+
+		{
+			EL_ERROR(!savegame_map.has_thing_map, TException, "no <compressedThingMapDeflate> node found");
+
+			// base64-decode and inflate the thing grid in small chunks and place the obstacles row by row,
+			// so neither the compressed data nor the full grid have to be kept in memory
+			static const usys_t SZ_CHUNK = 16 * 1024;
+			TList<byte_t> compressed_chunk;
+			compressed_chunk.Inflate(SZ_CHUNK, 0);
+			TList<u16_t> terrain_row;
+			terrain_row.Inflate(this->size[0], 0);
+			const usys_t sz_row = this->size[0] * sizeof(u16_t);
+
+			string_view base64_text = savegame_map.ThingMapBase64();
+			TBase64Decoder decoder;
+			TRawInflateStream inflater;
+			z_stream& zs = inflater.zs;
+			bool input_done = false;
+			s16_t y = 0;
+
+			zs.next_out = (byte_t*)&terrain_row[0];
+			zs.avail_out = sz_row;
+
+			for(;;)
+			{
+				if(zs.avail_in == 0 && !input_done)
+				{
+					// keep 2 bytes for the tail of unpadded input
+					usys_t n_decoded = decoder.Decode(base64_text, &compressed_chunk[0], SZ_CHUNK - 2);
+					if(base64_text.size() == 0 || decoder.Finished())
+					{
+						n_decoded += decoder.Finish(&compressed_chunk[n_decoded]);
+						input_done = true;
+					}
+					zs.next_in = &compressed_chunk[0];
+					zs.avail_in = n_decoded;
+				}
+
+				const int ret = inflate(&zs, Z_NO_FLUSH);
+				EL_ERROR(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR, TException, TString::Format("corrupt <compressedThingMapDeflate> data (zlib: %s)", zs.msg != nullptr ? zs.msg : "unknown error"));
+
+				if(zs.avail_out == 0)
+				{
+					EL_ERROR(y >= this->size[1], TException, "<compressedThingMapDeflate> holds more data than the map size allows");
+
+					for(s16_t x = 0; x < this->size[0]; x++)
+					{
+						if(terrain_row[x] != 0)
 						{
-							n_lights++;
-							this->lights.Append(light_source_t({pos, 4}));
+							n_terrain++;
+							if(this->obstacle_map->IsValidPosition({x,y}))
+								this->obstacle_map->PlaceObstacleAt({x,y}, EObstacleType::WALL);
 						}
 					}
+
+					y++;
+					zs.next_out = (byte_t*)&terrain_row[0];
+					zs.avail_out = sz_row;
+				}
+
+				if(ret == Z_STREAM_END)
+					break;
+
+				EL_ERROR(ret == Z_BUF_ERROR && input_done && zs.avail_in == 0, TException, "<compressedThingMapDeflate> data is truncated");
+			}
+
+			EL_ERROR(y != this->size[1] || zs.avail_out != sz_row, TException, TString::Format("<compressedThingMapDeflate> does not match the map size (got %d rows, expected %d)", y, this->size[1]));
+		}
+
+		// count the lights first, so the list is allocated only once
+		usys_t n_light_things = 0;
+		for(usys_t i = 0; i < savegame_map.things.size(); i++)
+			if(savegame_map.things[i].type == EThingType::LAMP || savegame_map.things[i].type == EThingType::WALL_LIGHT)
+				n_light_things++;
+		SizeExactly(this->lights, n_light_things, LIGHT_NONE);
+
+		const TDefRegistry& registry = TDefRegistry::Instance();
+		for(usys_t i = 0; i < savegame_map.things.size(); i++)
+		{
+			const thing_t& thing = savegame_map.things[i];
+			const TDefRegistry::def_t& def = registry.Def(thing.id_def);
+			switch(thing.type)
+			{
+				case EThingType::WALL:
+					n_walls++;
+					this->PlaceFootprint(thing, def, EObstacleType::WALL);
+					break;
+
+				case EThingType::DOOR:
+					n_doors++;
+					this->PlaceFootprint(thing, def, EObstacleType::DOOR);
+					break;
+
+				case EThingType::WINDOW:
+					n_windows++;
+					this->PlaceFootprint(thing, def, EObstacleType::WINDOW);
+					break;
+
+				case EThingType::TERRAIN:
+					n_terrain++;
+					this->PlaceFootprint(thing, def, EObstacleType::WALL);
+					break;
+
+				case EThingType::LAMP:
+					this->lights[n_lights++] = light_source_t({thing.pos, def.light_range, def.light_color});
+					break;
+
+				case EThingType::WALL_LIGHT:
+					this->lights[n_lights++] = light_source_t({thing.pos + RimworldRotationToVector(thing.rot), def.light_range, def.light_color});
+					break;
+
+				case EThingType::IGNORE:
+				case EThingType::BUILDING:
+					break;
+			}
+		}
+
+		log<<"walls: "<<n_walls<<endl;
+		log<<"doors: "<<n_doors<<endl;
+		log<<"windows: "<<n_windows<<endl;
+		log<<"terrain: "<<n_terrain<<endl;
+		log<<"lights: "<<n_lights<<endl;
+
+		this->ComputeGraph(graph_options, log);
+
+#ifdef RIM2VTT_CHECK_CULLING
+		if(this->culled)
+		{
+			ostringstream unculled_log;
+			const TMap unculled(savegame_map, unculled_log, graph_options, false);
+			EL_ERROR(!SameGraphInImageArea(*this, unculled), TLogicException);
+		}
+#endif
+	}
+
+	void TMap::ExportVTT(TUvttWriter& out, TFile* const image)
+	{
+		if(image != nullptr)
+		{
+			TMapping mapping(image);
+			this->ExportVTT(out, mapping.Count() > 0 ? &mapping[0] : nullptr, mapping.Count());
+		}
+		else
+			this->ExportVTT(out, nullptr, 0);
+	}
+
+	static s16_t ToHalfTiles(const float value)
+	{
+		const float half_tiles = value * 2.0f;
+		EL_ERROR(half_tiles != (float)(s16_t)half_tiles, TException, "coordinate cannot be represented in the cache format");
+		return (s16_t)half_tiles;
+	}
+
+	void TMap::WriteCache(ostream& os) const
+	{
+		const TList<const obstacle_t>& obstacles = this->obstacle_map->Graph();
+
+		cache_header_t header;
+		memcpy(header.magic, cache_header_t::MAGIC, sizeof(header.magic));
+		header.version = cache_header_t::VERSION;
+		header.size[0] = this->size[0];
+		header.size[1] = this->size[1];
+		header.image_pos[0] = this->image_pos[0];
+		header.image_pos[1] = this->image_pos[1];
+		header.image_size[0] = this->image_size[0];
+		header.image_size[1] = this->image_size[1];
+		header.n_obstacles = obstacles.Count();
+		header.n_lights = this->lights.Count();
+		os.write((const char*)&header, sizeof(header));
+
+		for(usys_t i = 0; i < obstacles.Count(); i++)
+		{
+			cache_obstacle_t obstacle;
+			for(unsigned j = 0; j < 2; j++)
+			{
+				obstacle.pos[j][0] = ToHalfTiles(obstacles[i].pos[j][0]);
+				obstacle.pos[j][1] = ToHalfTiles(obstacles[i].pos[j][1]);
+			}
+			obstacle.type = obstacles[i].type;
+			os.write((const char*)&obstacle, sizeof(obstacle));
+		}
+
+		static const char PADDING[alignof(cache_light_t)] = {};
+		os.write(PADDING, CacheLightsOffset(header.n_obstacles) - sizeof(header) - header.n_obstacles * sizeof(cache_obstacle_t));
+
+		for(usys_t i = 0; i < this->lights.Count(); i++)
+		{
+			const cache_light_t light = { { this->lights[i].pos[0], this->lights[i].pos[1] }, this->lights[i].range, this->lights[i].color };
+			os.write((const char*)&light, sizeof(light));
+		}
+	}
+
+	TMap::TMap(const cache_header_t& header, const cache_obstacle_t* const obstacles, const cache_light_t* const lights) :
+		size({ header.size[0], header.size[1] }),
+		image_pos({ header.image_pos[0], header.image_pos[1] }),
+		image_size({ header.image_size[0], header.image_size[1] })
+	{
+		this->obstacle_map = this->CreateObstacleMap();
+		TList<obstacle_t>& graph = this->obstacle_map->RestoreGraph(header.n_obstacles);
+		for(u32_t i = 0; i < header.n_obstacles; i++)
+		{
+			const cache_obstacle_t& obstacle = obstacles[i];
+			graph[i] = obstacle_t({
+				{
+					v2f_t({ obstacle.pos[0][0] / 2.0f, obstacle.pos[0][1] / 2.0f }),
+					v2f_t({ obstacle.pos[1][0] / 2.0f, obstacle.pos[1][1] / 2.0f })
+				},
+				obstacle.type
+			});
+		}
+
+		SizeExactly(this->lights, header.n_lights, LIGHT_NONE);
+		for(u32_t i = 0; i < header.n_lights; i++)
+			this->lights[i] = light_source_t({ v2i_t({ lights[i].pos[0], lights[i].pos[1] }), lights[i].range, lights[i].color });
+	}
+
+	void TMap::WriteDump(ostream& os) const
+	{
+		map_dump_header_t header;
+		memcpy(header.magic, map_dump_header_t::MAGIC, sizeof(header.magic));
+		header.version = map_dump_header_t::VERSION;
+		header.size[0] = this->size[0];
+		header.size[1] = this->size[1];
+		header.image_pos[0] = this->image_pos[0];
+		header.image_pos[1] = this->image_pos[1];
+		header.image_size[0] = this->image_size[0];
+		header.image_size[1] = this->image_size[1];
+		header.n_planes = (u32_t)EObstacleType::DOOR;
+		header.n_lights = this->lights.Count();
+		header.byte_order = map_dump_header_t::BYTE_ORDER_MARK;
+
+		// the rest of the map is culled anyway
+		v2i_t window_pos, window_size;
+		this->CullWindow(window_pos, window_size);
+		header.window_pos[0] = window_pos[0];
+		header.window_pos[1] = window_pos[1];
+		header.window_size[0] = window_size[0];
+		header.window_size[1] = window_size[1];
+		os.write((const char*)&header, sizeof(header));
+
+		const usys_t n_words = map_dump_header_t::WordsPerPlane(header.window_size);
+		TList<u64_t> plane;
+		plane.Inflate(n_words, 0);
+
+		for(u32_t idx_plane = 0; idx_plane < header.n_planes; idx_plane++)
+		{
+			const EObstacleType type = (EObstacleType)(idx_plane + 1);
+			for(usys_t i = 0; i < n_words; i++)
+				plane[i] = 0;
+
+			for(s16_t y = 0; y < window_size[1]; y++)
+				for(s16_t x = 0; x < window_size[0]; x++)
+				{
+					if(this->obstacle_map->TypeAt(window_pos + v2i_t({x,y})) == type)
+					{
+						const usys_t idx_tile = (usys_t)y * window_size[0] + x;
+						plane[idx_tile / 64] |= (u64_t)1 << (idx_tile % 64);
+					}
+				}
+
+			os.write((const char*)&plane[0], n_words * sizeof(u64_t));
+		}
+
+		for(usys_t i = 0; i < this->lights.Count(); i++)
+		{
+			const cache_light_t light = { { this->lights[i].pos[0], this->lights[i].pos[1] }, this->lights[i].range, this->lights[i].color };
+			os.write((const char*)&light, sizeof(light));
+		}
+	}
+
+	static const map_dump_header_t& CheckMapDump(const byte_t* const dump, const usys_t sz_dump)
+	{
+		EL_ERROR(sz_dump < sizeof(map_dump_header_t), TException, "map dump is truncated");
+		const map_dump_header_t& header = *(const map_dump_header_t*)dump;
+		EL_ERROR(memcmp(header.magic, map_dump_header_t::MAGIC, sizeof(header.magic)) != 0, TException, "not a rim2vtt map dump");
+		EL_ERROR(header.byte_order == __builtin_bswap32(map_dump_header_t::BYTE_ORDER_MARK), TException, "map dump was written on a machine with a different byte order");
+		EL_ERROR(header.version != map_dump_header_t::VERSION, TException, TString::Format("unsupported map dump version %d", header.version));
+		EL_ERROR(header.size[0] <= 0 || header.size[1] <= 0 || header.n_planes > (u32_t)EObstacleType::DOOR, TException, "corrupt map dump header");
+		EL_ERROR(header.window_pos[0] < 0 || header.window_pos[1] < 0 || header.window_size[0] < 0 || header.window_size[1] < 0, TException, "corrupt map dump header");
+		EL_ERROR(header.window_pos[0] + header.window_size[0] > header.size[0] || header.window_pos[1] + header.window_size[1] > header.size[1], TException, "corrupt map dump header");
+		EL_ERROR(sz_dump != sizeof(header) + header.n_planes * map_dump_header_t::WordsPerPlane(header.window_size) * sizeof(u64_t) + header.n_lights * sizeof(cache_light_t), TException, "map dump has the wrong size");
+		return header;
+	}
+
+	static v2i_t MapDumpSize(const byte_t* const dump, const usys_t sz_dump)
+	{
+		const map_dump_header_t& header = CheckMapDump(dump, sz_dump);
+		return v2i_t({ header.size[0], header.size[1] });
+	}
+
+	TMap::TMap(const byte_t* const dump, const usys_t sz_dump, ostream& log, const graph_options_t& graph_options) : size(MapDumpSize(dump, sz_dump))
+	{
+		const map_dump_header_t& header = *(const map_dump_header_t*)dump;
+		const usys_t n_words = map_dump_header_t::WordsPerPlane(header.window_size);
+		const v2i_t window_pos = { header.window_pos[0], header.window_pos[1] };
+		const v2i_t window_size = { header.window_size[0], header.window_size[1] };
+		const u64_t* const planes = (const u64_t*)(dump + sizeof(header));
+		const cache_light_t* const lights = (const cache_light_t*)(planes + header.n_planes * n_words);
+
+		this->image_pos = { header.image_pos[0], header.image_pos[1] };
+		this->image_size = { header.image_size[0], header.image_size[1] };
+
+		log<<endl<<"size: ["<<this->size[0]<<"; "<<this->size[1]<<"]"<<endl;
+		log<<"image area: pos = {"<<this->image_pos[0]<<"; "<<this->image_pos[1]<<"}, size = {"<<this->image_size[0]<<"; "<<this->image_size[1]<<"}"<<endl;
+		this->obstacle_map = this->CreateObstacleMap();
+
+		for(u32_t idx_plane = 0; idx_plane < header.n_planes; idx_plane++)
+		{
+			const EObstacleType type = (EObstacleType)(idx_plane + 1);
+			const u64_t* const plane = planes + idx_plane * n_words;
+			for(usys_t idx_word = 0; idx_word < n_words; idx_word++)
+			{
+				for(u64_t word = plane[idx_word]; word != 0; word &= word - 1)
+				{
+					const usys_t idx_tile = idx_word * 64 + __builtin_ctzll(word);
+					EL_ERROR(idx_tile >= (usys_t)window_size[0] * window_size[1], TException, "corrupt map dump (bit outside of the window)");
+					const v2i_t pos = window_pos + v2i_t({ (s16_t)(idx_tile % window_size[0]), (s16_t)(idx_tile / window_size[0]) });
+					if(this->obstacle_map->IsValidPosition(pos))
+						this->obstacle_map->PlaceObstacleAt(pos, type);
+				}
+			}
+		}
+
+		SizeExactly(this->lights, header.n_lights, LIGHT_NONE);
+		for(u32_t i = 0; i < header.n_lights; i++)
+			this->lights[i] = light_source_t({ v2i_t({ lights[i].pos[0], lights[i].pos[1] }), lights[i].range, lights[i].color });
+
+		log<<"lights: "<<header.n_lights<<endl;
+
+		this->ComputeGraph(graph_options, log);
+	}
+
+	template<typename TSegments>
+	void TMap::ExportGeometry(TUvttWriter& out, const v2i_t area_pos, const v2i_t area_size, const TSegments& obstacles, const vector<vector<v2f_t>>& polylines)
+	{
+		out<<"{\n";
+		out<<"\"format\":0.2,\n";
+		out<<"\"resolution\":{\n";
+		out<<"\"map_origin\":{ \"x\":0, \"y\":0 },\n";
+		out<<"\"map_size\":{ \"x\":"<<area_size[0]<<", \"y\":"<<area_size[1]<<" },\n";
+		out<<"\"pixels_per_grid\":"<<this->pixels_per_grid<<"\n";
+		out<<"},\n";
+		out<<"\"line_of_sight\":[\n";
+
+		bool first = true;
+
+		for(usys_t i = 0; i < polylines.size() && this->export_polylines; i++)
+		{
+			const vector<v2f_t>& polyline = polylines[i];
+
+			if(!first) out<<",";
+			first = false;
+			out<<"[\n";
+			for(usys_t j = 0; j < polyline.size(); j++)
+			{
+				const v2f_t point = polyline[j] - (v2f_t)area_pos + v2f_t({0.5f,0.5f});
+				out<<"  { \"x\": "<<point[0]<<", \"y\": "<<(area_size[1] - point[1])<<" }"<<(j + 1 < polyline.size() ? "," : "")<<"\n";
+			}
+			out<<"]\n";
+		}
+
+		for(usys_t i = 0; i < obstacles.Count(); i++)
+		{
+			if(obstacles[i].type == EObstacleType::WALL && !this->export_polylines)
+			{
+				const v2f_t from = obstacles[i].pos[0] - (v2f_t)area_pos + v2f_t({0.5f,0.5f});
+				const v2f_t to   = obstacles[i].pos[1] - (v2f_t)area_pos + v2f_t({0.5f,0.5f});
+
+				if(!first) out<<",";
+				first = false;
+				out<<"[\n";
+				out<<"  { \"x\": "<<from[0]<<", \"y\": "<<(area_size[1] - from[1])<<" },\n";
+				out<<"  { \"x\": "<<to[0]  <<", \"y\": "<<(area_size[1] - to[1]  )<<" }\n";
+				out<<"]\n";
+			}
+		}
+
+		out<<"],\n";
+		out<<"\"portals\": [\n";
+
+		first = true;
+		for(usys_t i = 0; i < obstacles.Count(); i++)
+		{
+			if(obstacles[i].type == EObstacleType::DOOR)
+			{
+				/*
+					{
+						" *position": {
+							"x": 50,
+							"y": 48.5
+						},
+						"bounds": [
+							{
+							"x": 50,
+							"y": 48
+							},
+							{
+							"x": 50,
+							"y": 49
+							}
+						],
+						"rotation": 4.712389,
+						"closed": true,
+						"freestanding": false
+					},
+				*/
+
+				const v2f_t from = obstacles[i].pos[0] - (v2f_t)area_pos + v2f_t({0.5f,0.5f});
+				const v2f_t to   = obstacles[i].pos[1] - (v2f_t)area_pos + v2f_t({0.5f,0.5f});
+				const v2f_t center = (from + to) / 2.0f;
+
+				if(!first) out<<",";
+				first = false;
+				out<<"{\n";
+				out<<"  \"position\": { \"x\": "<<center[0]<<", \"y\": "<<(area_size[1] - center[1])<<" },\n";
+				out<<"  \"bounds\": [\n";
+				out<<"    { \"x\": "<<from[0]<<", \"y\": "<<(area_size[1] - from[1])<<" },\n";
+				out<<"    { \"x\": "<<to[0]  <<", \"y\": "<<(area_size[1] - to[1]  )<<" }\n";
+				out<<"  ],\n";
+				out<<"  \"rotation\": 1,\n";
+				out<<"  \"closed\": true,\n";
+				out<<"  \"freestanding\": false\n";
+				out<<"}\n";
+			}
+		}
+		out<<"],\n";
+		out<<"\"environment\": { \"baked_lighting\": false, \"ambient_light\": \"00000000\" },\n";
+
+		/*
+			{
+				"position": {
+					"x": 38.742462,
+					"y": 44.529297
+				},
+				"range": 4.5,
+				"intensity": 1,
+				"color": "ffffad58",
+				"shadows": true
+			},
+		*/
+
+		out<<"\"lights\": [\n";
+		first = true;
+		for(usys_t i = 0; i < lights.Count(); i++)
+		{
+			if(lights[i].pos.AllBiggerEqual(area_pos) && lights[i].pos.AllLess(area_pos + area_size))
+			{
+				v2i_t eff_pos = lights[i].pos - area_pos;
+				eff_pos[1] = area_size[1] - eff_pos[1] - 1;
+				if(!first) out<<",";
+				first = false;
+				out<<"{\n";
+				out<<"  \"position\": { \"x\": "<<eff_pos[0]<<".5, \"y\": "<<eff_pos[1]<<".5 },\n";
+				out<<"  \"range\": "<<(lights[i].range/4.0f)<<",\n";
+				out<<"  \"intensity\": 1,\n";
+				char color[9];
+				snprintf(color, sizeof(color), "%08x", lights[i].color);
+				out<<"  \"color\": \""<<color<<"\",\n";
+				out<<"  \"shadows\": true\n";
+				out<<"}\n";
+			}
+		}
+		out<<"],\n";
+	}
+
+	void TMap::ExportGeometry(TUvttWriter& out)
+	{
+		this->ExportGeometry(out, this->image_pos, this->image_size, this->obstacle_map->Graph(), this->wall_polylines);
+	}
+
+	// writes the image (or null) and the end of the document
+	static void ExportImage(TUvttWriter& out, const byte_t* const image, const usys_t sz_image)
+	{
+		if(image != nullptr)
+		{
+			// encode the image in fixed size chunks straight into the output buffer
+			static const usys_t SZ_CHUNK = 48 * 1024;	// must be a multiple of 3 => no padding between chunks
+
+			out<<"\"image\":\"";
+			for(usys_t offset = 0; offset < sz_image; offset += SZ_CHUNK)
+			{
+				const usys_t n_chunk = sz_image - offset < SZ_CHUNK ? sz_image - offset : SZ_CHUNK;
+				char* const b64_chunk = out.Claim(TBase64Encoder::EncodedSize(n_chunk));
+				out.Commit(TBase64Encoder::Encode(image + offset, n_chunk, b64_chunk));
+			}
+			out<<"\"\n";
+		}
+		else
+			out<<"\"image\":null\n";
+		out<<"}\n";
+	}
+
+	void TMap::ExportVTT(TUvttWriter& out, const byte_t* const image, const usys_t sz_image)
+	{
+		this->ExportGeometry(out);
+		ExportImage(out, image, sz_image);
+	}
+
+	void TMap::ExportVTT(TUvttWriter& out, const scene_tile_t& tile, const byte_t* const image, const usys_t sz_image)
+	{
+		this->ExportGeometry(out, tile.pos, tile.size, tile.segments, tile.wall_polylines);
+		ExportImage(out, image, sz_image);
+	}
+
+	void TMap::ExportVTT(TUvttWriter& out, TImageEncoder* const image)
+	{
+		this->ExportGeometry(out);
+
+		if(image != nullptr)
+		{
+			out<<"\"image\":\"";
+			image->WriteTo(out);
+			out<<"\"\n";
+		}
+		else
+			out<<"\"image\":null\n";
+		out<<"}\n";
+	}
+
+	/****************************************************************************/
+
+	// On-disk cache of parsed maps, keyed by the hash of the savegame bytes and the map index.
+	// An entry holds everything ExportVTT needs (graph, lights, image area), so a cache hit skips the
+	// XML parsing, the thing grid decoding and ComputeObstacleGraph. The least recently used entries
+	// are deleted once the total size of the cache exceeds max_size (the file mtime is the access time).
+	//
+	// entry file (native byte order, coordinates in half tiles):
+	//   cache_header_t | n_obstacles * cache_obstacle_t | padding (see CacheLightsOffset()) | n_lights * cache_light_t
+	class TConversionCache
+	{
+		protected:
+			const filesystem::path directory;
+			const u64_t max_size;
+			mutex mtx_evict;
+
+			filesystem::path EntryPath(const string& key) const { return this->directory / (key + ".r2vc"); }
+			void Evict();
+
+		public:
+			static string Key(const void* const savegame, const usys_t sz_savegame, const unsigned idx_map, const graph_options_t& graph_options);
+
+			// returns nullptr on a cache miss
+			unique_ptr<TMap> Load(const string& key, ostream& log);
+			void Store(const string& key, const TMap& map, ostream& log);
+
+			TConversionCache(const char* const directory, const u64_t max_size);
+	};
+
+	string TConversionCache::Key(const void* const savegame, const usys_t sz_savegame, const unsigned idx_map, const graph_options_t& graph_options)
+	{
+		// the def registry decides which things end up in the map and the graph options how they end up in the graph
+		// => both are part of the key (the default graph options leave it as it was before there were any)
+		const XXH128_hash_t hash = XXH3_128bits_withSeed(savegame, sz_savegame, TDefRegistry::Instance().Fingerprint());
+		char key[96];
+		if(graph_options.Fingerprint() == 0)
+			snprintf(key, sizeof(key), "%016llx%016llx-%u", (unsigned long long)hash.high64, (unsigned long long)hash.low64, idx_map);
+		else
+			snprintf(key, sizeof(key), "%016llx%016llx-g%llx-%u", (unsigned long long)hash.high64, (unsigned long long)hash.low64, (unsigned long long)graph_options.Fingerprint(), idx_map);
+		return key;
+	}
+
+	unique_ptr<TMap> TConversionCache::Load(const string& key, ostream& log)
+	{
+		const filesystem::path path = this->EntryPath(key);
+		error_code ec;
+		if(!filesystem::exists(path, ec))
+			return nullptr;
+
+		try
+		{
+			TFile file(path.c_str());
+			TMapping mapping(&file);
+			EL_ERROR(mapping.Count() < sizeof(cache_header_t), TException, "truncated cache entry");
+
+			const cache_header_t& header = *(const cache_header_t*)&mapping[0];
+			EL_ERROR(memcmp(header.magic, cache_header_t::MAGIC, sizeof(header.magic)) != 0 || header.version != cache_header_t::VERSION, TException, "unknown cache entry format");
+			EL_ERROR(mapping.Count() != CacheLightsOffset(header.n_obstacles) + header.n_lights * sizeof(cache_light_t), TException, "truncated cache entry");
+
+			const cache_obstacle_t* const obstacles = (const cache_obstacle_t*)(&mapping[0] + sizeof(cache_header_t));
+			const cache_light_t* const lights = (const cache_light_t*)(&mapping[0] + CacheLightsOffset(header.n_obstacles));
+			unique_ptr<TMap> map(new TMap(header, obstacles, lights));
+
+			// mark as recently used
+			filesystem::last_write_time(path, filesystem::file_time_type::clock::now(), ec);
+			log<<endl<<"cache hit: "<<key<<endl;
+			return map;
+		}
+		catch(const IException& e)
+		{
+			log<<"WARNING: dropping unusable cache entry "<<key<<": "<<e.Message().MakeCStr().get()<<endl;
+			filesystem::remove(path, ec);
+			return nullptr;
+		}
+	}
+
+	void TConversionCache::Store(const string& key, const TMap& map, ostream& log)
+	{
+		const filesystem::path path = this->EntryPath(key);
+		ostringstream tmp_name;
+		tmp_name<<key<<".tmp."<<getpid()<<"."<<this_thread::get_id();
+		const filesystem::path tmp_path = this->directory / tmp_name.str();
+
+		try
+		{
+			{
+				ofstream os(tmp_path, ios::out | ios::trunc | ios::binary);
+				EL_ERROR(!os.is_open(), TException, "unable to create cache entry");
+				map.WriteCache(os);
+				os.close();
+				EL_ERROR(os.fail(), TException, "unable to write cache entry");
+			}
+
+			// rename() is atomic => concurrent readers never see a partial entry
+			error_code ec;
+			filesystem::rename(tmp_path, path, ec);
+			EL_ERROR(ec, TException, TString::Format("unable to rename cache entry: %s", ec.message().c_str()));
+		}
+		catch(const IException& e)
+		{
+			log<<"WARNING: unable to store cache entry "<<key<<": "<<e.Message().MakeCStr().get()<<endl;
+			error_code ec;
+			filesystem::remove(tmp_path, ec);
+			return;
+		}
+
+		this->Evict();
+	}
+
+	void TConversionCache::Evict()
+	{
+		lock_guard<mutex> lock(this->mtx_evict);
+
+		struct entry_t
+		{
+			filesystem::file_time_type ts_access;
+			u64_t size;
+			filesystem::path path;
+		};
+
+		vector<entry_t> entries;
+		u64_t total_size = 0;
+		error_code ec;
+		for(const auto& dir_entry : filesystem::directory_iterator(this->directory, ec))
+		{
+			if(dir_entry.path().extension() != ".r2vc")
+				continue;
+			const u64_t size = dir_entry.file_size(ec);
+			if(ec)
+				continue;
+			entries.push_back({ dir_entry.last_write_time(ec), size, dir_entry.path() });
+			total_size += size;
+		}
+
+		if(total_size <= this->max_size)
+			return;
+
+		sort(entries.begin(), entries.end(), [](const entry_t& a, const entry_t& b) { return a.ts_access < b.ts_access; });
+		for(usys_t i = 0; i < entries.size() && total_size > this->max_size; i++)
+			if(filesystem::remove(entries[i].path, ec))
+				total_size -= entries[i].size;
+	}
+
+	TConversionCache::TConversionCache(const char* const directory, const u64_t max_size) : directory(directory), max_size(max_size)
+	{
+		// an unusable cache directory only costs the caching - Store() warns about every entry it cannot write
+		error_code ec;
+		filesystem::create_directories(this->directory, ec);
+		if(ec)
+			cerr<<"WARNING: unable to create cache directory "<<this->directory.string()<<": "<<ec.message()<<endl;
+	}
+
+	// takes the map from the cache (if there is one), else calls parse() and stores the result in the cache
+	// the cache holds the graph as computed, the export options are applied afterwards
+	static unique_ptr<TMap> LoadMap(TConversionCache* const cache, const string& key, const export_options_t& options, ostream& log, const function<unique_ptr<TMap>()>& parse)
+	{
+		unique_ptr<TMap> map = cache != nullptr ? cache->Load(key, log) : nullptr;
+		if(map == nullptr)
+		{
+			map = parse();
+			if(cache != nullptr)
+				cache->Store(key, *map, log);
+		}
+
+		map->PrepareExport(options, log);
+		return map;
+	}
+
+	/****************************************************************************/
+
+	// creates output_path and lets export_document write the document into it
+	static void WriteDocument(const string& output_path, const export_options_t& options, ostream& log, const function<void(TUvttWriter& out)>& export_document)
+	{
+		const int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		EL_ERROR(fd < 0, TException, TString::Format("unable to open output file %q", output_path.c_str()));
+
+		try
+		{
+			TUvttWriter out(fd, options.compact, options.compression);
+			export_document(out);
+			out.Finish();
+			out.Report(log);
+		}
+		catch(...)
+		{
+			close(fd);
+			throw;
+		}
+
+		EL_ERROR(close(fd) != 0, TException, TString::Format("error while writing %q", output_path.c_str()));
+	}
+
+	static void WriteUVTT(TMap& map, TFile* const image, const string& output_path, const export_options_t& options, ostream& log)
+	{
+		WriteDocument(output_path, options, log, [&](TUvttWriter& out) {
+			if(image != nullptr && options.pixels_per_grid > 0)
+			{
+				// the other maps run on the other threads => resample on this one only
+				TMapping mapping(image);
+				const string png = ResampleImageFile(mapping.Count() > 0 ? &mapping[0] : nullptr, mapping.Count(), options.pixels_per_grid, 1, log);
+				map.ExportVTT(out, (const byte_t*)png.data(), png.size());
+			}
+			else
+				map.ExportVTT(out, image);
+		});
+	}
+
+	// ask the kernel to start reading the file in the background
+	static void Prefetch(TMapping& mapping)
+	{
+		if(mapping.Count() > 0)
+			madvise((void*)&mapping[0], mapping.Count(), MADV_WILLNEED);
+	}
+
+	static double SecondsSince(const chrono::steady_clock::time_point ts_start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - ts_start).count();
+	}
+
+	/****************************************************************************/
+
+	// Allocation instrumentation: the replacement operator new at the end of this file counts every allocation,
+	// per thread and for the whole process. A conversion in the multi-map modes runs on a single worker thread, so
+	// the thread counters attribute the allocations to it even while other conversions run in parallel.
+	// Counting costs every allocation a few atomic operations, so it is only compiled in with RIM2VTT_COUNT_ALLOCATIONS,
+	// otherwise only the peak RSS is reported.
+#ifdef RIM2VTT_COUNT_ALLOCATIONS
+	struct alloc_counters_t
+	{
+		u64_t n_allocations;
+		u64_t sz_allocated;
+	};
+
+	static thread_local alloc_counters_t thread_alloc_counters = { 0, 0 };
+	static atomic<u64_t> process_n_allocations(0);
+	static atomic<u64_t> process_sz_allocated(0);
+
+	static void CountAllocation(const usys_t size)
+	{
+		thread_alloc_counters.n_allocations++;
+		thread_alloc_counters.sz_allocated += size;
+		process_n_allocations.fetch_add(1, memory_order_relaxed);
+		process_sz_allocated.fetch_add(size, memory_order_relaxed);
+	}
+#endif
+
+	static double PeakRssMiB()
+	{
+		struct rusage usage;
+		EL_ERROR(getrusage(RUSAGE_SELF, &usage) != 0, TException, TString::Format("getrusage() failed: %s", strerror(errno)));
+		return usage.ru_maxrss / 1024.0;	// ru_maxrss is in KiB
+	}
+
+	// counts the allocations of a conversion from its construction on
+	// whole_process: count the allocations of all threads (single map mode, where the graph bands run on their own threads)
+	// The peak RSS is always that of the whole process (getrusage() has nothing finer), also in the multi-map modes.
+	class TAllocationMeter
+	{
+#ifdef RIM2VTT_COUNT_ALLOCATIONS
+		protected:
+			const bool whole_process;
+			const alloc_counters_t start;
+
+			alloc_counters_t Now() const
+			{
+				if(this->whole_process)
+					return { process_n_allocations.load(memory_order_relaxed), process_sz_allocated.load(memory_order_relaxed) };
+				return thread_alloc_counters;
+			}
+
+		public:
+			void Report(ostream& log) const
+			{
+				const alloc_counters_t now = this->Now();
+				log<<"allocations: "<<(now.n_allocations - this->start.n_allocations)<<" ("<<(now.sz_allocated - this->start.sz_allocated) / (1024.0 * 1024.0)<<" MiB), process peak RSS: "<<PeakRssMiB()<<" MiB"<<endl;
+			}
+
+			TAllocationMeter(const bool whole_process) : whole_process(whole_process), start(Now()) {}
+#else
+		public:
+			void Report(ostream& log) const
+			{
+				log<<"process peak RSS: "<<PeakRssMiB()<<" MiB"<<endl;
+			}
+
+			TAllocationMeter(const bool whole_process) {}
+#endif
+	};
+
+	struct map_job_t
+	{
+		string_view xml;	// the map's <li> element within the mapped savegame
+		TFile* image;
+		string output_path;
+		string cache_key;
+		ostringstream log;
+		string error;
+	};
+
+	static void ConvertMapJob(map_job_t& job, TConversionCache* const cache, const export_options_t& options)
+	{
+		const TAllocationMeter meter(false);
+		try
+		{
+			unique_ptr<TMap> map = LoadMap(cache, job.cache_key, options, job.log, [&job, &options]() {
+				TSavegameReader reader(0, true, true);
+				TSaxParser(job.xml.data(), job.xml.size()).Parse(reader);
+				EL_ERROR(!reader.FoundMap(), TLogicException);
+				return unique_ptr<TMap>(new TMap(reader.map, job.log, options.graph));
+			});
+
+			WriteUVTT(*map, job.image, job.output_path, options, job.log);
+			meter.Report(job.log);
+		}
+		catch(const IException& e)
+		{
+			job.error = e.Message().MakeCStr().get();
+		}
+		catch(const exception& e)
+		{
+			job.error = e.what();
+		}
+	}
+
+	// converts every map in the savegame into its own <output_prefix><map-index>.uvtt file
+	// the maps are processed in parallel - one map per worker thread
+	// images[i] (if present) is the ProgressRenderer image for map i
+	static bool ConvertAllMaps(const char* const savegame_path, const TList<TFile*>& images, const char* const output_prefix, const usys_t n_threads, TConversionCache* const cache, const export_options_t& options)
+	{
+		TFile savegame_file(savegame_path);
+		TMapping savegame_mapping(&savegame_file);
+		EL_ERROR(savegame_mapping.Count() == 0, TException, "savegame file is empty");
+
+		const char* const xml = (const char*)&savegame_mapping[0];
+		TMapLocator locator(xml + savegame_mapping.Count());
+		TSaxParser(xml, savegame_mapping.Count()).Parse(locator);
+		EL_ERROR(locator.maps.Count() == 0, TException, "no map found in savegame");
+		EL_ERROR(images.Count() > locator.maps.Count(), TException, TString::Format("got more images (%d) than there are maps in the savegame (%d)", images.Count(), locator.maps.Count()));
+
+		const usys_t n_maps = locator.maps.Count();
+		unique_ptr<map_job_t[]> jobs(new map_job_t[n_maps]);
+		for(usys_t i = 0; i < n_maps; i++)
+		{
+			jobs[i].xml = locator.maps[i];
+			jobs[i].image = i < images.Count() ? images[i] : nullptr;
+			jobs[i].output_path = string(output_prefix) + to_string(i) + options.Extension();
+		}
+
+		if(cache != nullptr)
+		{
+			// the key covers the whole savegame, so the hash only needs to be computed once
+			const string key = TConversionCache::Key(xml, savegame_mapping.Count(), 0, options.graph);
+			const string key_prefix = key.substr(0, key.rfind('-') + 1);
+			for(usys_t i = 0; i < n_maps; i++)
+				jobs[i].cache_key = key_prefix + to_string(i);
+		}
+
+		{
+			// the biggest map determines the total runtime, so the pool never needs more workers than maps
+			TWorkerPool pool(min(n_maps, n_threads > 0 ? n_threads : DefaultThreadCount()), n_maps);
+			for(usys_t i = 0; i < n_maps; i++)
+				pool.Submit([&jobs, i, cache, &options]() { ConvertMapJob(jobs[i], cache, options); });
+			pool.Join();
+		}
+
+		bool success = true;
+		for(usys_t i = 0; i < n_maps; i++)
+		{
+			cerr<<jobs[i].log.str();
+			if(jobs[i].error.empty())
+				cerr<<"=> "<<jobs[i].output_path<<endl;
+			else
+			{
+				cerr<<"ERROR: map #"<<i<<": "<<jobs[i].error<<endl;
+				success = false;
+			}
+		}
+
+		return success;
+	}
+
+	/****************************************************************************/
+
+	struct tile_job_t
+	{
+		scene_tile_t tile;
+		string output_path;
+		ostringstream log;
+		string error;
+	};
+
+	static void ExportTileJob(tile_job_t& job, TMap& map, const unsigned col, const unsigned row, const unsigned n_cols, const unsigned n_rows, const image_t& image, const export_options_t& options)
+	{
+		try
+		{
+			scene_tile_t& tile = job.tile;
+			map.CutTile(tile, col, row, n_cols, n_rows);
+			job.log<<"tile "<<tile.col<<"x"<<tile.row<<": pos = {"<<tile.pos[0]<<"; "<<tile.pos[1]<<"}, size = {"<<tile.size[0]<<"; "<<tile.size[1]<<"}, segments: "<<tile.segments.Count()<<endl;
+
+			string png;
+			if(image.pixels != nullptr)
+			{
+				// the image covers the whole image area, rows counted from the top
+				const u64_t cell_x = tile.pos[0] - map.image_pos[0];
+				const u64_t cell_y = map.image_pos[1] + map.image_size[1] - tile.pos[1] - tile.size[1];
+				const u32_t x_begin = cell_x * image.width / map.image_size[0];
+				const u32_t x_end = (cell_x + tile.size[0]) * image.width / map.image_size[0];
+				const u32_t y_begin = cell_y * image.height / map.image_size[1];
+				const u32_t y_end = (cell_y + tile.size[1]) * image.height / map.image_size[1];
+				EL_ERROR(x_end <= x_begin || y_end <= y_begin, TException, "the image is too small for this many tiles");
+
+				image_t crop = CropImage(image, x_begin, y_begin, x_end - x_begin, y_end - y_begin);
+				if(options.pixels_per_grid > 0)
+					crop = ResampleImage(crop, (u32_t)tile.size[0] * options.pixels_per_grid, (u32_t)tile.size[1] * options.pixels_per_grid, 1);
+				png = EncodePng(crop, 1);
+			}
+
+			WriteDocument(job.output_path, options, job.log, [&](TUvttWriter& out) {
+				map.ExportVTT(out, tile, png.empty() ? nullptr : (const byte_t*)png.data(), png.size());
+			});
+		}
+		catch(const IException& e)
+		{
+			job.error = e.Message().MakeCStr().get();
+		}
+		catch(const exception& e)
+		{
+			job.error = e.what();
+		}
+	}
+
+	// --tiles: splits the image area into n_cols x n_rows scenes, every scene is written to
+	// <output_prefix><col>_<row>.uvtt with the walls, doors and lights on it and its crop of the image
+	// (which therefore has to be a PNG image, see DecodePng()). All tiles are cut from the graph of the map, which is
+	// only computed once, and are exported in parallel - one tile per worker thread.
+	static bool ExportTiles(TMap& map, TFile* const image_file, const unsigned n_cols, const unsigned n_rows, const char* const output_prefix, const usys_t n_threads, const export_options_t& options)
+	{
+		EL_ERROR(n_cols > (unsigned)map.image_size[0] || n_rows > (unsigned)map.image_size[1], TException, TString::Format("the image area (%dx%d) is too small for %ux%u tiles", map.image_size[0], map.image_size[1], n_cols, n_rows));
+
+		image_t image = { 0, 0, 0, nullptr };
+		if(image_file != nullptr)
+		{
+			TMapping mapping(image_file);
+			image = DecodePng(mapping.Count() > 0 ? &mapping[0] : nullptr, mapping.Count());
+		}
+
+		const usys_t n_tiles = (usys_t)n_cols * n_rows;
+		unique_ptr<tile_job_t[]> jobs(new tile_job_t[n_tiles]);
+
+		{
+			TWorkerPool pool(min(n_tiles, n_threads > 0 ? n_threads : DefaultThreadCount()), n_tiles);
+			for(unsigned row = 0; row < n_rows; row++)
+				for(unsigned col = 0; col < n_cols; col++)
+				{
+					tile_job_t& job = jobs[(usys_t)row * n_cols + col];
+					job.output_path = string(output_prefix) + to_string(col) + "_" + to_string(row) + options.Extension();
+					pool.Submit([&job, &map, &image, &options, col, row, n_cols, n_rows]() { ExportTileJob(job, map, col, row, n_cols, n_rows, image, options); });
+				}
+			pool.Join();
+		}
+
+		bool success = true;
+		for(usys_t i = 0; i < n_tiles; i++)
+		{
+			cerr<<jobs[i].log.str();
+			if(jobs[i].error.empty())
+				cerr<<"=> "<<jobs[i].output_path<<endl;
+			else
+			{
+				cerr<<"ERROR: "<<jobs[i].output_path<<": "<<jobs[i].error<<endl;
+				success = false;
+			}
+		}
+
+		return success;
+	}
+
+	/****************************************************************************/
+
+	struct batch_job_t
+	{
+		string savegame_path;
+		string image_path;	// empty => no image
+		string output_path;
+		ostringstream log;
+		string error;
+		u64_t n_bytes;
+		double seconds;
+
+		batch_job_t() : n_bytes(0), seconds(0) {}
+	};
+
+	// the files of a batch job, opened and mapped ahead of time by the loader
+	struct batch_input_t
+	{
+		unique_ptr<TFile> savegame_file;
+		unique_ptr<TMapping> savegame_mapping;
+		unique_ptr<TFile> image_file;
+		unique_ptr<TMapping> image_mapping;
+	};
+
+	// manifest: one job per line - "savegame<TAB>image<TAB>output", image may be empty or "-"
+	// empty lines and lines starting with '#' are ignored
+	static void ReadBatchManifest(const char* const manifest_path, vector<unique_ptr<batch_job_t>>& jobs)
+	{
+		ifstream is(manifest_path);
+		EL_ERROR(!is.is_open(), TException, TString::Format("unable to open batch manifest %q", manifest_path));
+
+		string line;
+		for(unsigned line_number = 1; getline(is, line); line_number++)
+		{
+			if(line.empty() || line[0] == '#')
+				continue;
+
+			string fields[3];
+			usys_t idx_field = 0;
+			for(const char chr : line)
+			{
+				if(chr == '\t')
+				{
+					idx_field++;
+					EL_ERROR(idx_field >= 3, TException, TString::Format("too many fields in batch manifest line %d", line_number));
+				}
+				else if(chr != '\r')
+					fields[idx_field] += chr;
+			}
+			EL_ERROR(idx_field != 2 || fields[0].empty() || fields[2].empty(), TException, TString::Format("batch manifest line %d does not have the format \"savegame<TAB>image<TAB>output\"", line_number));
+
+			unique_ptr<batch_job_t> job(new batch_job_t());
+			job->savegame_path = fields[0];
+			job->image_path = fields[1] == "-" ? string() : fields[1];
+			job->output_path = fields[2];
+			jobs.push_back(move(job));
+		}
+	}
+
+	// directory: every *.rws file becomes a job, <name>.png/.jpg/.jpeg next to it is used as image
+	// and the output is written to <name>.uvtt (or <name>.uvtt.gz, see export_options_t::Extension())
+	static void ReadBatchDirectory(const char* const directory_path, const char* const output_extension, vector<unique_ptr<batch_job_t>>& jobs)
+	{
+		vector<filesystem::path> savegames;
+		error_code ec;
+		filesystem::directory_iterator it(directory_path, ec);
+		for(; !ec && it != filesystem::directory_iterator(); it.increment(ec))
+		{
+			error_code ec_entry;	// entries which cannot be examined are skipped
+			if(it->is_regular_file(ec_entry) && it->path().extension() == ".rws")
+				savegames.push_back(it->path());
+		}
+		EL_ERROR(ec, TException, TString::Format("unable to read directory %q: %s", directory_path, ec.message().c_str()));
+		sort(savegames.begin(), savegames.end());
+
+		for(const auto& savegame : savegames)
+		{
+			unique_ptr<batch_job_t> job(new batch_job_t());
+			job->savegame_path = savegame.string();
+			for(const char* const extension : { ".png", ".jpg", ".jpeg" })
+			{
+				filesystem::path image = savegame;
+				image.replace_extension(extension);
+				if(filesystem::exists(image, ec))
+				{
+					job->image_path = image.string();
+					break;
+				}
+			}
+
+			filesystem::path output = savegame;
+			output.replace_extension(output_extension);
+			job->output_path = output.string();
+			jobs.push_back(move(job));
+		}
+	}
+
+	static void ConvertBatchJob(batch_job_t& job, const batch_input_t& input, TConversionCache* const cache, const export_options_t& options)
+	{
+		const auto ts_start = chrono::steady_clock::now();
+		const TAllocationMeter meter(false);
+		try
+		{
+			const char* const xml = (const char*)&(*input.savegame_mapping)[0];
+			const usys_t sz_xml = input.savegame_mapping->Count();
+
+			unique_ptr<TMap> map = LoadMap(cache, cache != nullptr ? TConversionCache::Key(xml, sz_xml, 0, options.graph) : string(), options, job.log, [&]() {
+				TSavegameReader reader(0, true);
+				TSaxParser(xml, sz_xml).Parse(reader);
+				EL_ERROR(!reader.FoundMap(), TException, "no map found in savegame");
+				return unique_ptr<TMap>(new TMap(reader.map, job.log, options.graph));
+			});
+
+			WriteUVTT(*map, input.image_file.get(), job.output_path, options, job.log);
+			meter.Report(job.log);
+		}
+		catch(const IException& e)
+		{
+			job.error = e.Message().MakeCStr().get();
+		}
+		catch(const exception& e)
+		{
+			job.error = e.what();
+		}
+		job.seconds = SecondsSince(ts_start);
+	}
+
+	// Converts all jobs from a manifest file or a directory on a fixed pool of worker threads.
+	// The main thread acts as loader: it opens and maps the files of the upcoming jobs and asks the kernel
+	// to read them in, while the workers are busy with the previous jobs. It can get at most one job per
+	// worker ahead of them.
+	static bool ConvertBatch(const char* const manifest_or_directory, const usys_t n_threads, TConversionCache* const cache, const export_options_t& options)
+	{
+		// anything that cannot be examined is taken for a manifest, which ReadBatchManifest() then fails to open
+		vector<unique_ptr<batch_job_t>> jobs;
+		error_code ec;
+		if(filesystem::is_directory(manifest_or_directory, ec))
+			ReadBatchDirectory(manifest_or_directory, options.Extension(), jobs);
+		else
+			ReadBatchManifest(manifest_or_directory, jobs);
+
+		const auto ts_start = chrono::steady_clock::now();
+		usys_t n_workers = 0;
+
+		{
+			TWorkerPool pool(n_threads);
+			n_workers = pool.CountThreads();
+
+			for(usys_t i = 0; i < jobs.size(); i++)
+			{
+				batch_job_t& job = *jobs[i];
+				shared_ptr<batch_input_t> input(new batch_input_t());
+				try
+				{
+					input->savegame_file = unique_ptr<TFile>(new TFile(job.savegame_path.c_str()));
+					input->savegame_mapping = unique_ptr<TMapping>(new TMapping(input->savegame_file.get()));
+					EL_ERROR(input->savegame_mapping->Count() == 0, TException, "savegame file is empty");
+					Prefetch(*input->savegame_mapping);
+					job.n_bytes += input->savegame_mapping->Count();
+
+					if(!job.image_path.empty())
+					{
+						input->image_file = unique_ptr<TFile>(new TFile(job.image_path.c_str()));
+						input->image_mapping = unique_ptr<TMapping>(new TMapping(input->image_file.get()));
+						Prefetch(*input->image_mapping);
+						job.n_bytes += input->image_mapping->Count();
+					}
 				}
-				else if(strcmp(thing_node->Attribute("Class"), "Mineable") == 0)
+				catch(const IException& e)
 				{
-					n_terrain++;
-					this->obstacle_map.PlaceObstacleAt(pos, EObstacleType::WALL);
+					job.error = e.Message().MakeCStr().get();
+					continue;
 				}
-				else if(strcmp(thing_node->Attribute("Class"), "MURWallLight.WallLight") == 0)
+				catch(const exception& e)
 				{
-					n_lights++;
-					auto rot_node = thing_node->FirstChildElement("rot");
-					const int rot = (rot_node == nullptr) ? 0 : rot_node->Int64Text(0);
-					this->lights.Append(light_source_t({pos + RimworldRotationToVector(rot), 6}));
+					job.error = e.what();
+					continue;
 				}
+
+				pool.Submit([&job, input, cache, &options]() { ConvertBatchJob(job, *input, cache, options); });
+			}
+
+			pool.Join();
+		}
+
+		const double seconds_total = SecondsSince(ts_start);
+
+		usys_t n_failed = 0;
+		u64_t n_bytes_total = 0;
+		for(usys_t i = 0; i < jobs.size(); i++)
+		{
+			const batch_job_t& job = *jobs[i];
+			cerr<<job.log.str();
+			if(job.error.empty())
+			{
+				cerr<<"=> "<<job.output_path<<" ("<<job.seconds * 1000.0<<" ms)"<<endl;
+				n_bytes_total += job.n_bytes;
+			}
+			else
+			{
+				cerr<<"ERROR: "<<job.savegame_path<<": "<<job.error<<endl;
+				n_failed++;
 			}
 		}
 
-		cerr<<"walls: "<<n_walls<<endl;
-		cerr<<"doors: "<<n_doors<<endl;
-		cerr<<"windows: "<<n_windows<<endl;
-		cerr<<"terrain: "<<n_terrain<<endl;
-		cerr<<"lights: "<<n_lights<<endl;
+		cerr<<endl<<"batch: "<<jobs.size()<<" jobs ("<<n_failed<<" failed) on "<<n_workers<<" workers in "<<seconds_total<<" s"<<endl;
+		if(seconds_total > 0)
+			cerr<<"throughput: "<<(jobs.size() - n_failed) / seconds_total<<" jobs/s, "<<(n_bytes_total / (1024.0 * 1024.0)) / seconds_total<<" MiB/s"<<endl;
 
-		this->obstacle_map.ComputeObstacleGraph();
-		cerr<<"obstacles: "<<this->obstacle_map.Graph().Count()<<endl;
+		return n_failed == 0;
 	}
 
-	void TMap::ExportVTT(ostream& os, TFile* const image)
+	/****************************************************************************/
+
+	// Conversion server (--serve). Listens on a unix domain socket ("unix:/path") or on a localhost
+	// TCP port ("PORT" or "127.0.0.1:PORT") and keeps the process warm between requests.
+	//
+	// Protocol (a connection can send any number of requests):
+	//   request:  "CONVERT <savegame-bytes> <image-bytes>\n" <savegame> <image>   (image-bytes may be 0)
+	//             "STATS\n"
+	//   response: "OK <bytes>\n" <UVTT document or stats text>
+	//             "ERROR <bytes>\n" <message>
+	//
+	// Connections are handed to a worker pool through a bounded queue. A worker stays with its connection
+	// until the client closes it or stays silent for IO_TIMEOUT seconds, so idle clients cannot hold on to
+	// all workers. When all workers are busy and the queue is full the server stops accepting, so further
+	// clients wait in the listen backlog.
+	class TConversionServer
 	{
-		const TList<const obstacle_t>& obstacles = this->obstacle_map.Graph();
+		protected:
+			static const usys_t MAX_PAYLOAD = 1024ULL * 1024ULL * 1024ULL;
+			static const usys_t N_LATENCY_SAMPLES = 16384;
+			static const int IO_TIMEOUT = 30;	// seconds
 
-		os<<"{"<<endl;;
-		os<<"\"format\":0.2,"<<endl;
-		os<<"\"resolution\":{"<<endl;
-		os<<"\"map_origin\":{ \"x\":0, \"y\":0 },"<<endl;
-		os<<"\"map_size\":{ \"x\":"<<this->image_size[0]<<", \"y\":"<<this->image_size[1]<<" },"<<endl;
-		os<<"\"pixels_per_grid\":64"<<endl;
-		os<<"},"<<endl;
-		os<<"\"line_of_sight\":["<<endl;
+			int fd_listen;
+			TConversionCache* const cache;
+			const export_options_t options;
+			mutex mtx_stats;
+			u64_t n_requests;
+			u64_t n_errors;
+			TList<float> latencies_ms;	// ring buffer of the most recent request latencies
+			usys_t idx_next_latency;
 
-		bool first = true;
+			static bool ReadAll(const int fd, void* const buffer, const usys_t size);
+			static void WriteAll(const int fd, const void* const buffer, const usys_t size);
+			static bool ReadLine(const int fd, string& line);
+			static void SendResponse(const int fd, const char* const status, const string& payload);
 
-		for(usys_t i = 0; i < obstacles.Count(); i++)
+			void RecordRequest(const double ms, const bool success);
+			string Stats();
+			string Convert(const string& savegame, const string& image);
+			void HandleConnection(const int fd);
+
+		public:
+			void Run(const usys_t n_threads);
+
+			TConversionServer(const char* const address, TConversionCache* const cache, const export_options_t& options);
+			~TConversionServer();
+	};
+
+	bool TConversionServer::ReadAll(const int fd, void* const buffer, const usys_t size)
+	{
+		usys_t n_done = 0;
+		while(n_done < size)
 		{
-			if(obstacles[i].type == EObstacleType::WALL)
-			{
-				if(IsWithinImageArea(obstacles[i].pos[0]) || IsWithinImageArea(obstacles[i].pos[1]))
-				{
-					const v2f_t from = obstacles[i].pos[0] - (v2f_t)this->image_pos + v2f_t({0.5f,0.5f});
-					const v2f_t to   = obstacles[i].pos[1] - (v2f_t)this->image_pos + v2f_t({0.5f,0.5f});
+			const ssize_t r = read(fd, (byte_t*)buffer + n_done, size - n_done);
+			if(r < 0 && errno == EINTR)
+				continue;
+			if(r <= 0)
+				return false;
+			n_done += r;
+		}
+		return true;
+	}
 
-					if(!first) os<<",";
-					first = false;
-					os<<"["<<endl;
-					os<<"  { \"x\": "<<from[0]<<", \"y\": "<<(this->image_size[1] - from[1])<<" },"<<endl;
-					os<<"  { \"x\": "<<to[0]  <<", \"y\": "<<(this->image_size[1] - to[1]  )<<" }"<<endl;
-					os<<"]";;
-					os<<endl;
-				}
-			}
+	void TConversionServer::WriteAll(const int fd, const void* const buffer, const usys_t size)
+	{
+		usys_t n_done = 0;
+		while(n_done < size)
+		{
+			const ssize_t r = send(fd, (const byte_t*)buffer + n_done, size - n_done, MSG_NOSIGNAL);
+			if(r < 0 && errno == EINTR)
+				continue;
+			EL_ERROR(r <= 0, TException, TString::Format("unable to send response: %s", strerror(errno)));
+			n_done += r;
+		}
+	}
+
+	bool TConversionServer::ReadLine(const int fd, string& line)
+	{
+		line.clear();
+		for(;;)
+		{
+			char chr;
+			if(!ReadAll(fd, &chr, 1))
+				return false;
+			if(chr == '\n')
+				return true;
+			EL_ERROR(line.size() >= 256, TException, "request header too long");
+			line += chr;
 		}
+	}
 
-		os<<"],"<<endl;
-		os<<"\"portals\": ["<<endl;
+	void TConversionServer::SendResponse(const int fd, const char* const status, const string& payload)
+	{
+		const string header = string(status) + " " + to_string(payload.size()) + "\n";
+		WriteAll(fd, header.data(), header.size());
+		WriteAll(fd, payload.data(), payload.size());
+	}
 
-		first = true;
-		for(usys_t i = 0; i < obstacles.Count(); i++)
+	void TConversionServer::RecordRequest(const double ms, const bool success)
+	{
+		lock_guard<mutex> lock(this->mtx_stats);
+		this->n_requests++;
+		if(!success)
+			this->n_errors++;
+
+		if(this->latencies_ms.Count() < N_LATENCY_SAMPLES)
+			this->latencies_ms.Append((float)ms);
+		else
+			this->latencies_ms[this->idx_next_latency] = (float)ms;
+		this->idx_next_latency = (this->idx_next_latency + 1) % N_LATENCY_SAMPLES;
+	}
+
+	string TConversionServer::Stats()
+	{
+		vector<float> sorted;
+		u64_t n_requests;
+		u64_t n_errors;
 		{
-			if(obstacles[i].type == EObstacleType::DOOR)
+			lock_guard<mutex> lock(this->mtx_stats);
+			n_requests = this->n_requests;
+			n_errors = this->n_errors;
+			for(usys_t i = 0; i < this->latencies_ms.Count(); i++)
+				sorted.push_back(this->latencies_ms[i]);
+		}
+		sort(sorted.begin(), sorted.end());
+
+		auto percentile = [&sorted](const double p) { return sorted.empty() ? 0.0f : sorted[(usys_t)(p * (sorted.size() - 1) + 0.5)]; };
+
+		ostringstream ss;
+		ss<<"requests: "<<n_requests<<"\n";
+		ss<<"errors: "<<n_errors<<"\n";
+		ss<<"samples: "<<sorted.size()<<"\n";
+		ss<<"latency_ms_p50: "<<percentile(0.50)<<"\n";
+		ss<<"latency_ms_p90: "<<percentile(0.90)<<"\n";
+		ss<<"latency_ms_p99: "<<percentile(0.99)<<"\n";
+		ss<<"latency_ms_max: "<<(sorted.empty() ? 0.0f : sorted.back())<<"\n";
+#ifdef RIM2VTT_COUNT_ALLOCATIONS
+		ss<<"allocations: "<<process_n_allocations.load(memory_order_relaxed)<<"\n";
+		ss<<"allocated_mib: "<<process_sz_allocated.load(memory_order_relaxed) / (1024.0 * 1024.0)<<"\n";
+#endif
+		ss<<"peak_rss_mib: "<<PeakRssMiB()<<"\n";
+		return ss.str();
+	}
+
+	string TConversionServer::Convert(const string& savegame, const string& image)
+	{
+		EL_ERROR(savegame.empty(), TException, "savegame is empty");
+
+		ostringstream log;
+		unique_ptr<TMap> map = LoadMap(this->cache, this->cache != nullptr ? TConversionCache::Key(savegame.data(), savegame.size(), 0, this->options.graph) : string(), this->options, log, [&]() {
+			TSavegameReader reader(0, true);
+			TSaxParser(savegame.data(), savegame.size()).Parse(reader);
+			EL_ERROR(!reader.FoundMap(), TException, "no map found in savegame");
+			return unique_ptr<TMap>(new TMap(reader.map, log, this->options.graph));
+		});
+
+		// the workers of the pool serve several requests at once => the image is resampled on this thread only
+		const string resampled = !image.empty() && this->options.pixels_per_grid > 0 ? ResampleImageFile((const byte_t*)image.data(), image.size(), this->options.pixels_per_grid, 1, log) : string();
+		const string& embedded = resampled.empty() ? image : resampled;
+
+		string document;
+		TUvttWriter out(document, this->options.compact, this->options.compression);
+		map->ExportVTT(out, embedded.empty() ? nullptr : (const byte_t*)embedded.data(), embedded.size());
+		out.Finish();
+		return document;
+	}
+
+	void TConversionServer::HandleConnection(const int fd)
+	{
+		try
+		{
+			string line;
+			while(ReadLine(fd, line))
 			{
-				/*
-					{
-						" *position": {
-							"x": 50,
-							"y": 48.5
-						},
-						"bounds": [
-							{
-							"x": 50,
-							"y": 48
-							},
-							{
-							"x": 50,
-							"y": 49
-							}
-						],
-						"rotation": 4.712389,
-						"closed": true,
-						"freestanding": false
-					},
-				*/
+				const auto ts_start = chrono::steady_clock::now();
+
+				if(line == "STATS")
+				{
+					SendResponse(fd, "OK", this->Stats());
+					continue;
+				}
+
+				unsigned long long sz_savegame = 0;
+				unsigned long long sz_image = 0;
+				if(sscanf(line.c_str(), "CONVERT %llu %llu", &sz_savegame, &sz_image) != 2)
+				{
+					SendResponse(fd, "ERROR", "unknown request");
+					break;
+				}
+
+				if(sz_savegame > MAX_PAYLOAD || sz_image > MAX_PAYLOAD)
+				{
+					SendResponse(fd, "ERROR", "payload too large");
+					break;
+				}
 
-				if(IsWithinImageArea(obstacles[i].pos[0]) || IsWithinImageArea(obstacles[i].pos[1]))
+				string savegame;
+				string image;
+				try
+				{
+					savegame.resize(sz_savegame);
+					image.resize(sz_image);
+				}
+				catch(const bad_alloc&)
 				{
-					const v2f_t from = obstacles[i].pos[0] - (v2f_t)this->image_pos + v2f_t({0.5f,0.5f});
-					const v2f_t to   = obstacles[i].pos[1] - (v2f_t)this->image_pos + v2f_t({0.5f,0.5f});
-					const v2f_t center = (from + to) / 2.0f;
+					SendResponse(fd, "ERROR", "not enough memory for the payload");
+					break;
+				}
+
+				if(!ReadAll(fd, &savegame[0], sz_savegame) || !ReadAll(fd, &image[0], sz_image))
+					break;
 
-					if(!first) os<<",";
-					first = false;
-					os<<"{"<<endl;
-					os<<"  \"position\": { \"x\": "<<center[0]<<", \"y\": "<<(this->image_size[1] - center[1])<<" },"<<endl;
-					os<<"  \"bounds\": ["<<endl;
-					os<<"    { \"x\": "<<from[0]<<", \"y\": "<<(this->image_size[1] - from[1])<<" },"<<endl;
-					os<<"    { \"x\": "<<to[0]  <<", \"y\": "<<(this->image_size[1] - to[1]  )<<" }"<<endl;
-					os<<"  ],"<<endl;
-					os<<"  \"rotation\": 1,"<<endl;
-					os<<"  \"closed\": true,"<<endl;
-					os<<"  \"freestanding\": false"<<endl;
-					os<<"}"<<endl;
+				bool success = true;
+				string result;
+				try
+				{
+					result = this->Convert(savegame, image);
+				}
+				catch(const IException& e)
+				{
+					success = false;
+					result = e.Message().MakeCStr().get();
+				}
+				catch(const exception& e)
+				{
+					success = false;
+					result = e.what();
 				}
+
+				SendResponse(fd, success ? "OK" : "ERROR", result);
+
+				const double ms = SecondsSince(ts_start) * 1000.0;
+				this->RecordRequest(ms, success);
+				cerr<<(success ? "converted " : "failed ")<<sz_savegame<<" + "<<sz_image<<" bytes in "<<ms<<" ms"<<endl;
 			}
 		}
-		os<<"],"<<endl;
-		os<<"\"environment\": { \"baked_lighting\": false, \"ambient_light\": \"00000000\" },"<<endl;
+		catch(const IException& e)
+		{
+			cerr<<"ERROR: connection: "<<e.Message().MakeCStr().get()<<endl;
+		}
+		catch(const exception& e)
+		{
+			cerr<<"ERROR: connection: "<<e.what()<<endl;
+		}
 
-		/*
-			{
-				"position": {
-					"x": 38.742462,
-					"y": 44.529297
-				},
-				"range": 4.5,
-				"intensity": 1,
-				"color": "ffffad58",
-				"shadows": true
-			},
-		*/
+		close(fd);
+	}
 
-		os<<"\"lights\": ["<<endl;
-		first = true;
-		for(usys_t i = 0; i < lights.Count(); i++)
+	void TConversionServer::Run(const usys_t n_threads)
+	{
+		TWorkerPool pool(n_threads);
+		cerr<<"serving with "<<pool.CountThreads()<<" workers"<<endl;
+
+		for(;;)
 		{
-			if(IsWithinImageArea(lights[i].pos))
+			const int fd = accept4(this->fd_listen, nullptr, nullptr, SOCK_CLOEXEC);
+			if(fd < 0)
 			{
-				v2i_t eff_pos = lights[i].pos - image_pos;
-				eff_pos[1] = image_size[1] - eff_pos[1] - 1;
-				if(!first) os<<",";
-				first = false;
-				os<<"{"<<endl;
-				os<<"  \"position\": { \"x\": "<<eff_pos[0]<<".5, \"y\": "<<eff_pos[1]<<".5 },"<<endl;
-				os<<"  \"range\": "<<(lights[i].range/4.0f)<<","<<endl;
-				os<<"  \"intensity\": 1,"<<endl;
-				os<<"  \"color\": \"00000000\","<<endl;
-				os<<"  \"shadows\": true"<<endl;
-				os<<"}"<<endl;
+				EL_ERROR(errno != EINTR && errno != ECONNABORTED, TException, TString::Format("accept() failed: %s", strerror(errno)));
+				continue;
 			}
+
+			// a client which stops sending (or receiving) gets disconnected and frees its worker
+			const timeval timeout = { IO_TIMEOUT, 0 };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+			// blocks while the queue is full => backpressure
+			pool.Submit([this, fd]() { this->HandleConnection(fd); });
 		}
-		os<<"],"<<endl;
+	}
 
-		if(image != nullptr)
+	TConversionServer::TConversionServer(const char* const address, TConversionCache* const cache, const export_options_t& options) : fd_listen(-1), cache(cache), options(options), n_requests(0), n_errors(0), idx_next_latency(0)
+	{
+		if(strncmp(address, "unix:", 5) == 0)
 		{
-			TMapping mapping(image);
-			const int b64_size = Base64encode_len(mapping.Count());
-			TList<byte_t> b64_data;
-			b64_data.Inflate(b64_size, 0);
-			EL_ERROR(Base64encode((char*)&b64_data[0], (const char*)&mapping[0], mapping.Count()) != b64_size, TLogicException);
+			sockaddr_un sa = {};
+			sa.sun_family = AF_UNIX;
+			EL_ERROR(strlen(address + 5) >= sizeof(sa.sun_path), TException, "unix socket path too long");
+			strcpy(sa.sun_path, address + 5);
+
+			// a stale socket of an earlier run is replaced, anything else at the path is left alone (bind() fails then)
+			struct stat st;
+			if(lstat(sa.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+				unlink(sa.sun_path);
 
-			os<<"\"image\":\"";
-			os.write((const char*)&b64_data[0], b64_size - 1);
-			EL_ERROR(os.bad(), TException, "badbit set after write()");
-			os<<"\""<<endl;
+			EL_ERROR((this->fd_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0, TException, TString::Format("socket() failed: %s", strerror(errno)));
+			EL_ERROR(bind(this->fd_listen, (const sockaddr*)&sa, sizeof(sa)) != 0, TException, TString::Format("unable to bind to %q: %s", address, strerror(errno)));
 		}
 		else
-			os<<"\"image\":null"<<endl;
-		os<<"}"<<endl;
+		{
+			// TCP - only ever on the loopback interface
+			const char* const colon = strrchr(address, ':');
+			const char* const port_str = colon != nullptr ? colon + 1 : address;
+			EL_ERROR(colon != nullptr && strncmp(address, "127.0.0.1:", 10) != 0 && strncmp(address, "localhost:", 10) != 0, TException, "the TCP server only listens on localhost");
+
+			u32_t port = 0;
+			const char* const port_end = port_str + strlen(port_str);
+			const from_chars_result result = from_chars(port_str, port_end, port, 10);
+			EL_ERROR(result.ec != errc() || result.ptr != port_end || port < 1 || port > 65535, TException, TString::Format("invalid port %q (expected 1 to 65535)", port_str));
+
+			sockaddr_in sa = {};
+			sa.sin_family = AF_INET;
+			sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			sa.sin_port = htons((u16_t)port);
+
+			EL_ERROR((this->fd_listen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0, TException, TString::Format("socket() failed: %s", strerror(errno)));
+			const int on = 1;
+			setsockopt(this->fd_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			EL_ERROR(bind(this->fd_listen, (const sockaddr*)&sa, sizeof(sa)) != 0, TException, TString::Format("unable to bind to %q: %s", address, strerror(errno)));
+		}
+
+		EL_ERROR(listen(this->fd_listen, 64) != 0, TException, TString::Format("listen() failed: %s", strerror(errno)));
+	}
+
+	TConversionServer::~TConversionServer()
+	{
+		if(this->fd_listen >= 0)
+			close(this->fd_listen);
 	}
 }
 
@@ -712,27 +5327,249 @@ int main(int argc, char* argv[])
 {
 	try
 	{
-		XMLDocument doc;
-		unique_ptr<TFile> image = nullptr;
+		const char* all_maps_prefix = nullptr;
+		const char* batch = nullptr;
+		const char* serve = nullptr;
+		const char* cache_directory = nullptr;
+		const char* dump_map_file = nullptr;
+		const char* defs_file = nullptr;
+		const char* load_map_file = nullptr;
+		const char* tiles_prefix = nullptr;
+		unsigned n_tile_cols = 1;
+		unsigned n_tile_rows = 1;
+		u64_t cache_size_mib = 1024;
+		usys_t n_threads = 0;
+		export_options_t options;
+		TList<const char*> files;
+
+		for(int i = 1; i < argc; i++)
+		{
+			if(strcmp(argv[i], "--all-maps") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--all-maps requires an output prefix");
+				all_maps_prefix = argv[++i];
+			}
+			else if(strcmp(argv[i], "--batch") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--batch requires a manifest file or a directory");
+				batch = argv[++i];
+			}
+			else if(strcmp(argv[i], "--serve") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--serve requires an address (unix:/path/to/socket or a TCP port on localhost)");
+				serve = argv[++i];
+			}
+			else if(strcmp(argv[i], "--cache") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--cache requires a directory");
+				cache_directory = argv[++i];
+			}
+			else if(strcmp(argv[i], "--cache-size") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--cache-size requires a size in MiB");
+				cache_size_mib = strtoull(argv[++i], nullptr, 10);
+			}
+			else if(strcmp(argv[i], "--dump-map") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--dump-map requires an output file");
+				dump_map_file = argv[++i];
+			}
+			else if(strcmp(argv[i], "--load-map") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--load-map requires a map dump file");
+				load_map_file = argv[++i];
+			}
+			else if(strcmp(argv[i], "--defs") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--defs requires a rules file");
+				defs_file = argv[++i];
+			}
+			else if(strcmp(argv[i], "--engine") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--engine requires walker or contour");
+				const char* const engine = argv[++i];
+				if(strcmp(engine, "walker") == 0)
+					options.graph.engine = EGraphEngine::WALKER;
+				else if(strcmp(engine, "contour") == 0)
+					options.graph.engine = EGraphEngine::CONTOUR;
+				else
+					EL_THROW(TException, TString::Format("unknown engine %s (expected walker or contour)", engine));
+			}
+			else if(strcmp(argv[i], "--simplify") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--simplify requires a tolerance in tiles");
+				options.graph.simplify_tolerance = strtof(argv[++i], nullptr);
+				EL_ERROR(!(options.graph.simplify_tolerance >= 0.0f), TException, "--simplify requires a tolerance >= 0");
+			}
+			else if(strcmp(argv[i], "--no-merge") == 0)
+				options.merge_segments = false;
+			else if(strcmp(argv[i], "--polylines") == 0)
+				options.polylines = true;
+			else if(strcmp(argv[i], "--compact") == 0)
+				options.compact = true;
+			else if(strcmp(argv[i], "--compress") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--compress requires none or gzip");
+				const char* const compression = argv[++i];
+				if(strcmp(compression, "none") == 0)
+					options.compression = ECompression::NONE;
+				else if(strcmp(compression, "gzip") == 0)
+					options.compression = ECompression::GZIP;
+				else
+					EL_THROW(TException, TString::Format("unknown compression %s (expected none or gzip)", compression));
+			}
+			else if(strcmp(argv[i], "--ppg") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--ppg requires a number of pixels per cell");
+				options.pixels_per_grid = strtoul(argv[++i], nullptr, 10);
+				EL_ERROR(options.pixels_per_grid < 1 || options.pixels_per_grid > 1024, TException, "--ppg requires a number of pixels per cell between 1 and 1024");
+			}
+			else if(strcmp(argv[i], "--tiles") == 0)
+			{
+				EL_ERROR(i + 2 >= argc, TException, "--tiles requires the number of tiles (COLSxROWS) and an output prefix");
+				EL_ERROR(sscanf(argv[++i], "%ux%u", &n_tile_cols, &n_tile_rows) != 2 || n_tile_cols < 1 || n_tile_rows < 1, TException, "--tiles requires the number of tiles as COLSxROWS (e.g. 4x3)");
+				tiles_prefix = argv[++i];
+			}
+			else if(strcmp(argv[i], "--threads") == 0)
+			{
+				EL_ERROR(i + 1 >= argc, TException, "--threads requires a number");
+				n_threads = strtoul(argv[++i], nullptr, 10);
+			}
+			else
+				files.Append(argv[i]);
+		}
+
+		// must happen before any reader is created
+		if(defs_file != nullptr)
+			TDefRegistry::Instance().LoadFile(defs_file);
+
+		unique_ptr<TConversionCache> cache = cache_directory != nullptr ? unique_ptr<TConversionCache>(new TConversionCache(cache_directory, cache_size_mib * 1024 * 1024)) : nullptr;
+
+		if(serve != nullptr)
+		{
+			EL_ERROR(files.Count() > 0 || batch != nullptr || all_maps_prefix != nullptr || tiles_prefix != nullptr, TException, "--serve does not take any other files");
+			TConversionServer server(serve, cache.get(), options);
+			server.Run(n_threads);
+			return 0;
+		}
+
+		if(batch != nullptr)
+		{
+			EL_ERROR(files.Count() > 0 || all_maps_prefix != nullptr || tiles_prefix != nullptr, TException, "--batch does not take any other files");
+			return ConvertBatch(batch, n_threads, cache.get(), options) ? 0 : 1;
+		}
+
+		if(all_maps_prefix != nullptr)
+		{
+			EL_ERROR(files.Count() == 0, TException, "--all-maps requires a savegame file (stdin is not supported)");
+			EL_ERROR(tiles_prefix != nullptr, TException, "--tiles only works on a single map");
+
+			vector<unique_ptr<TFile>> image_files;
+			TList<TFile*> images;
+			for(usys_t i = 1; i < files.Count(); i++)
+			{
+				image_files.emplace_back(new TFile(files[i]));
+				images.Append(image_files.back().get());
+			}
 
-		if(argc == 3)
+			return ConvertAllMaps(files[0], images, all_maps_prefix, n_threads, cache.get(), options) ? 0 : 1;
+		}
+
+		if(load_map_file != nullptr)
+		{
+			EL_ERROR(files.Count() > 1 || dump_map_file != nullptr, TException, "--load-map takes at most an image file");
+		}
+		else
 		{
-			EL_ERROR(doc.LoadFile(argv[1]) != XML_SUCCESS, TException, "unable to load savegame XML");
-			image = unique_ptr<TFile>(new TFile(argv[2]));
+			EL_ERROR(files.Count() > 2, TException, TString::Format("got unexpected number of arguments (got: %d, expected: 1 to 3)", argc));
+			EL_ERROR(dump_map_file != nullptr && files.Count() > 1, TException, "--dump-map does not take an image file");
+			EL_ERROR(dump_map_file != nullptr && tiles_prefix != nullptr, TException, "--dump-map cannot be combined with --tiles");
 		}
-		else if(argc == 2)
+
+		// a single map gets all threads for its graph - the other modes run whole maps in parallel instead
+		options.graph.n_threads = n_threads > 0 ? n_threads : DefaultThreadCount();
+		const TAllocationMeter meter(true);
+
+		// the image is the last file (if any) - its encoding runs in the background while the map is loaded
+		// (the tiles cut it up themselves once the map is there)
+		const usys_t n_map_files = load_map_file != nullptr ? 0 : 1;
+		unique_ptr<TFile> image_file = files.Count() > n_map_files ? unique_ptr<TFile>(new TFile(files[n_map_files])) : nullptr;
+		unique_ptr<TImageEncoder> image = image_file != nullptr && tiles_prefix == nullptr ? unique_ptr<TImageEncoder>(new TImageEncoder(image_file.get(), options.pixels_per_grid, options.graph.n_threads)) : nullptr;
+
+		if(load_map_file != nullptr)
 		{
-			EL_ERROR(doc.LoadFile(argv[1]) != XML_SUCCESS, TException, "unable to load savegame XML");
+			TFile dump_file(load_map_file);
+			TMapping dump_mapping(&dump_file);
+
+			TMap map(dump_mapping.Count() > 0 ? &dump_mapping[0] : nullptr, dump_mapping.Count(), cerr, options.graph);
+			map.PrepareExport(options, cerr);
+			if(tiles_prefix != nullptr)
+			{
+				const bool success = ExportTiles(map, image_file.get(), n_tile_cols, n_tile_rows, tiles_prefix, options.graph.n_threads, options);
+				meter.Report(cerr);
+				return success ? 0 : 1;
+			}
+
+			TUvttWriter out(STDOUT_FILENO, options.compact, options.compression, options.graph.n_threads);
+			map.ExportVTT(out, image.get());
+			out.Finish();
+			out.Report(cerr);
+			meter.Report(cerr);
+			return 0;
 		}
-		else if(argc == 1)
+
+		unique_ptr<TFile> savegame_file = files.Count() >= 1 ? unique_ptr<TFile>(new TFile(files[0])) : nullptr;
+
+		unique_ptr<TMap> map = nullptr;
+
+		if(savegame_file != nullptr)
 		{
-			EL_ERROR(doc.LoadFile(stdin) != XML_SUCCESS, TException, "unable to load savegame XML");
+			// parse the savegame in-place - the reader keeps views into the mapping
+			TMapping savegame_mapping(savegame_file.get());
+			EL_ERROR(savegame_mapping.Count() == 0, TException, "savegame file is empty");
+			const char* const xml = (const char*)&savegame_mapping[0];
+
+			// the cache only holds the finished graph, which is not enough for a dump
+			TConversionCache* const map_cache = dump_map_file == nullptr ? cache.get() : nullptr;
+			map = LoadMap(map_cache, map_cache != nullptr ? TConversionCache::Key(xml, savegame_mapping.Count(), 0, options.graph) : string(), options, cerr, [&]() {
+				TSavegameReader reader(0, true);
+				TSaxParser(xml, savegame_mapping.Count()).Parse(reader);
+				EL_ERROR(!reader.FoundMap(), TException, "no map found in savegame");
+				return unique_ptr<TMap>(new TMap(reader.map, cerr, options.graph));
+			});
 		}
 		else
-			EL_THROW(TException, TString::Format("got unexpected number of arguments (got: %d, expected: 1 to 3)", argc));
+		{
+			// stdin cannot be hashed up-front => no caching
+			TSavegameReader reader(0, false);
+			TSaxParser(stdin).Parse(reader);
+			EL_ERROR(!reader.FoundMap(), TException, "no map found in savegame");
+			map = unique_ptr<TMap>(new TMap(reader.map, cerr, options.graph));
+			map->PrepareExport(options, cerr);
+		}
+
+		if(dump_map_file != nullptr)
+		{
+			ofstream os(dump_map_file, ios::out | ios::trunc | ios::binary);
+			EL_ERROR(!os, TException, TString::Format("unable to open %s for writing", dump_map_file));
+			map->WriteDump(os);
+			os.close();
+			EL_ERROR(!os, TException, TString::Format("failed to write map dump %s", dump_map_file));
+			return 0;
+		}
+
+		if(tiles_prefix != nullptr)
+		{
+			const bool success = ExportTiles(*map, image_file.get(), n_tile_cols, n_tile_rows, tiles_prefix, options.graph.n_threads, options);
+			meter.Report(cerr);
+			return success ? 0 : 1;
+		}
 
-		TMap map(doc.RootElement()->FirstChildElement("game")->FirstChildElement("maps")->FirstChildElement("li"));
-		map.ExportVTT(cout, image.get());
+		TUvttWriter out(STDOUT_FILENO, options.compact, options.compression, options.graph.n_threads);
+		map->ExportVTT(out, image.get());
+		out.Finish();
+		out.Report(cerr);
+		meter.Report(cerr);
 
 		return 0;
 	}
@@ -744,6 +5581,54 @@ int main(int argc, char* argv[])
 	{
 		cerr<<"ERROR: "<<e.Message().MakeCStr().get()<<endl;
 	}
+	catch(const exception& e)
+	{
+		cerr<<"ERROR: "<<e.what()<<endl;
+	}
 
 	return 1;
 }
+
+/****************************************************************************/
+
+#ifdef RIM2VTT_COUNT_ALLOCATIONS
+
+// counting replacements of the global allocation functions, see rim2vtt::TAllocationMeter
+// (the nothrow variants call these, the rarely used aligned variants are not counted)
+// noinline: gcc warns about mismatched new/delete pairs once it sees through them
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+	rim2vtt::CountAllocation(size);
+	void* const p = malloc(size > 0 ? size : 1);
+	if(p == nullptr)
+		throw bad_alloc();
+	return p;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+#endif